@@ -0,0 +1,26 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+
+// Helpers shared by the benchmarks, which print their results as CSV on the
+// standard output, keyed by their first two columns so that the runs of two
+// commits are compared with bench/compare.sh.
+
+namespace bench
+{
+    using clock = std::chrono::steady_clock;
+
+    /// Nanoseconds per call of `function`
+    template <typename F>
+    double measure(F function, std::size_t iterations)
+    {
+        auto start = clock::now();
+
+        for (std::size_t i = 0; i < iterations; i++)
+            function();
+
+        std::chrono::duration<double, std::nano> elapsed = clock::now() - start;
+        return elapsed.count() / iterations;
+    }
+} // namespace bench
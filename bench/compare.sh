@@ -0,0 +1,25 @@
+#!/bin/sh
+
+# Compare two runs of the benchmarks, e.g. `make -s bench > before.csv` on
+# two commits, and report the results at least THRESHOLD percent slower, 25 by
+# default, above the noise between two runs. Rows are matched on their first
+# two columns, the third one being a time per operation. Exit with 1 if any
+# result regressed.
+
+[ $# -ge 2 ] || { echo "usage: $0 before.csv after.csv [threshold]"; exit 1; }
+
+awk -F, -v threshold="${3:-25}" '
+    # Header rows have no number in the third column
+    $3 !~ /^[0-9.e+-]+$/ { next }
+    FNR == NR { before[$1 "," $2] = $3; next }
+    ($1 "," $2) in before {
+        old = before[$1 "," $2]
+        change = old > 0 ? ($3 - old) / old * 100 : 0
+        status = change >= threshold ? "REGRESSION" : "ok"
+        if (status != "ok")
+            regressions++
+        printf "%-26s %-14s %12.1f %12.1f %+8.1f%% %s\n", $1, $2, old, $3,
+               change, status
+    }
+    END { exit regressions > 0 }
+' "$1" "$2"
@@ -0,0 +1,57 @@
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "bench.hh"
+#include "utils/crc32c.hh"
+
+// Compare the cost of checksumming a message with the cost of copying it, a
+// message is copied at least once by MPI and once more by the receive queue
+// on its way from the leader to a follower.
+
+int main()
+{
+    // A heartbeat, a single AppendEntries, then batches of 16 to 256 entries
+    const std::vector<std::size_t> sizes{96, 160, 1024, 4096, 16384, 24576};
+
+    volatile std::uint32_t sink = 0;
+
+    std::cout
+        << "SIZE,IMPLEMENTATION,NS_PER_MESSAGE,MB_PER_S,RELATIVE_TO_COPY\n";
+
+    for (auto size : sizes)
+    {
+        std::vector<char> message(size);
+        std::vector<char> copy(size);
+        for (std::size_t i = 0; i < size; i++)
+            message[i] = static_cast<char>(i * 31 + 7);
+
+        auto iterations = std::max<std::size_t>(1000, (1 << 28) / size);
+
+        auto copy_ns = bench::measure(
+            [&] {
+                std::memcpy(copy.data(), message.data(), size);
+                sink = sink + copy[size / 2];
+            },
+            iterations);
+
+        auto hardware_ns = bench::measure(
+            [&] { sink = sink + utils::crc32c(message.data(), size); },
+            iterations);
+
+        auto table_ns = bench::measure(
+            [&] { sink = sink + utils::crc32c_portable(message.data(), size); },
+            iterations);
+
+        auto report = [&](const char* name, double ns) {
+            std::cout << size << "," << name << "," << ns << ","
+                      << size / ns * 1e3 << "," << ns / copy_ns << "\n";
+        };
+
+        report("memcpy", copy_ns);
+        report(utils::crc32c_implementation(), hardware_ns);
+        report("table", table_ns);
+    }
+
+    return 0;
+}
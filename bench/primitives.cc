@@ -0,0 +1,284 @@
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "bench.hh"
+#include "rpc/rpc.hh"
+#include "utils/bounded_string.hh"
+#include "utils/buffer.hh"
+#include "utils/log_entries.hh"
+#include "utils/logger.hh"
+#include "utils/quorum.hh"
+#include "utils/time.hh"
+
+// Cost of the building blocks on the path of a client request, measured in
+// isolation: the log of a server, the messages it sends, its logging, its
+// timeouts and the advancement of its commit index.
+
+namespace
+{
+    volatile std::size_t sink = 0;
+
+    void report(const std::string& name, const std::string& parameter,
+                double ns)
+    {
+        std::cout << name << "," << parameter << "," << ns << ","
+                  << 1e9 / ns << "\n";
+    }
+
+    rpc::ClientRequest request(unsigned id)
+    {
+        auto command = "c4_" + std::to_string(id);
+        return rpc::ClientRequest{4, 0, id,
+                                  rpc::command_t(command.data(),
+                                                 command.size())};
+    }
+
+    /// Entries a leader holds uncommited, the log of a server is otherwise
+    /// sealed as it is commited
+    constexpr int uncommitted = 256;
+
+    /// Log of `size` entries written in `directory`, commited but the last
+    /// `uncommitted` ones
+    utils::LogEntries make_log(const std::filesystem::path& directory,
+                               int size)
+    {
+        auto file = directory / ("entries_" + std::to_string(size) + ".log");
+        utils::LogEntries log(file);
+
+        for (int i = 0; i < size; i++)
+        {
+            log.append_entry(1, request(i));
+            if (i >= uncommitted)
+                log.commit_next_entry();
+        }
+
+        // Commited segments are sealed once written
+        log.wait_durable(log.last_log_index());
+
+        return log;
+    }
+
+    /// Nanoseconds per call of `function`, with `reset` run between the
+    /// calls and not timed
+    template <typename F, typename R>
+    double measure_each(F function, R reset, std::size_t iterations)
+    {
+        double elapsed = 0;
+        for (std::size_t i = 0; i < iterations; i++)
+        {
+            elapsed += bench::measure(function, 1);
+            reset();
+        }
+        return elapsed / iterations;
+    }
+
+    void log_entries(const std::filesystem::path& directory)
+    {
+        // From a single segment in memory to hundreds of sealed ones
+        for (int size : {1024, 16384, 262144})
+        {
+            auto log = make_log(directory, size);
+            auto id = static_cast<unsigned>(size);
+            auto append = [&] { log.append_entry(1, request(id++)); };
+
+            // Each append is commited and its write checked, so that segments
+            // are sealed as in a server
+            auto commit = [&] {
+                log.commit_next_entry();
+                log.durable_index();
+            };
+
+            report("append_entry", std::to_string(size),
+                   measure_each(append, commit,
+                                utils::LogEntries::segment_size));
+
+            report("commit_next_entry", std::to_string(size),
+                   measure_each([&] { log.commit_next_entry(); },
+                                [&] {
+                                    append();
+                                    log.durable_index();
+                                },
+                                utils::LogEntries::segment_size));
+
+            // Conflicting last entry, then the whole uncommited suffix
+            report("delete_from_index", std::to_string(size) + "/1",
+                   measure_each(
+                       [&] { log.delete_from_index(log.last_log_index()); },
+                       append, 1000));
+
+            report("delete_from_index",
+                   std::to_string(size) + "/" + std::to_string(uncommitted),
+                   measure_each(
+                       [&] {
+                           log.delete_from_index(log.get_commit_index() + 1);
+                       },
+                       [&] {
+                           for (int i = 0; i < uncommitted; i++)
+                               append();
+                       },
+                       100));
+        }
+    }
+
+    void bounded_string()
+    {
+        auto a = request(123456).command;
+        auto b = request(123457).command;
+        std::string text = "c4_123456";
+
+        report("command_copy", "64",
+               bench::measure(
+                   [&] {
+                       rpc::command_t copy(a);
+                       sink = sink + copy[3];
+                   },
+                   1 << 24));
+
+        report("command_compare", "64",
+               bench::measure([&] { sink = sink + (a == b); }, 1 << 24));
+
+        report("command_from_chars", "64",
+               bench::measure(
+                   [&] {
+                       rpc::command_t command(text.data(), text.size());
+                       sink = sink + command[3];
+                   },
+                   1 << 24));
+    }
+
+    void serialization()
+    {
+        // Requests of a client as sent with client_batch=K, and the ids of
+        // the notification answering them
+        for (std::size_t size : {1, 16, 256})
+        {
+            std::vector<rpc::ClientRequest> requests;
+            std::vector<unsigned> ids;
+            for (std::size_t i = 0; i < size; i++)
+            {
+                requests.push_back(request(i));
+                ids.push_back(i);
+            }
+
+            report("buffer_client_requests", std::to_string(size),
+                   bench::measure(
+                       [&] {
+                           utils::Buffer buffer;
+                           buffer.push(requests);
+                           utils::Buffer received(buffer.bytes());
+                           sink = sink
+                               + received.pop_vector<rpc::ClientRequest>()
+                                     .size();
+                       },
+                       1 << 18));
+
+            rpc::ClientRequestResponse response{
+                1, 0, rpc::ClientRequestResponse::Status::COMMITTED, 1, 0};
+
+            report("buffer_client_response", std::to_string(size),
+                   bench::measure(
+                       [&] {
+                           utils::Buffer buffer;
+                           buffer.push(response);
+                           buffer.push(ids);
+                           utils::Buffer received(buffer.bytes());
+                           received.pop<rpc::ClientRequestResponse>();
+                           sink = sink
+                               + received.pop_vector<unsigned>().size();
+                       },
+                       1 << 18));
+        }
+
+        rpc::AppendEntries message{
+            1, 0, 1, 1, 41, 1, request(42), 1, 40, 0, 0.01};
+
+        report("buffer_append_entries", "1",
+               bench::measure(
+                   [&] {
+                       utils::Buffer buffer;
+                       buffer.push(message);
+                       utils::Buffer received(buffer.bytes());
+                       sink = sink
+                           + received.pop<rpc::AppendEntries>().prev_log_index;
+                   },
+                   1 << 20));
+    }
+
+    void logger(const std::filesystem::path& directory)
+    {
+        utils::Logger logger(directory / "log_bench.log");
+        unsigned id = 0;
+
+        report("logger_log", "info",
+               bench::measure(
+                   [&] {
+                       logger << utils::Logger::LogType::INFO
+                              << "Sending append entries to " << 2
+                              << ", client_id: " << 4
+                              << ", request_id: " << id++;
+                   },
+                   1 << 16));
+    }
+
+    void timeout()
+    {
+        utils::Timeout timeout(0.1, 0.5);
+
+        report("timeout_reset", "-",
+               bench::measure([&] { timeout.reset(); }, 1 << 16));
+
+        report("timeout_check", "-",
+               bench::measure([&] { sink = sink + bool(timeout); }, 1 << 20));
+    }
+
+    void quorum()
+    {
+        // Every follower acknowledges each index in turn, as a leader
+        // replicating one entry per heartbeat
+        for (int nb_server : {3, 5, 9})
+        {
+            utils::QuorumIndex match(nb_server);
+            int index = 0;
+            int server = 1;
+
+            report("quorum_update", std::to_string(nb_server),
+                   bench::measure(
+                       [&] {
+                           sink = sink + match.update(server, index);
+                           if (server++ == nb_server)
+                           {
+                               server = 1;
+                               index++;
+                           }
+                       },
+                       1 << 22));
+        }
+    }
+} // namespace
+
+int main()
+{
+    char directory_template[] = "/tmp/algorep_benchXXXXXX";
+    if (!mkdtemp(directory_template))
+    {
+        std::cerr << "cannot create a temporary directory\n";
+        return 1;
+    }
+    std::filesystem::path directory(directory_template);
+
+    std::cout << "BENCHMARK,PARAMETER,NS_PER_OP,OPS_PER_S\n";
+
+    log_entries(directory);
+    bounded_string();
+    serialization();
+    logger(directory);
+    timeout();
+    quorum();
+
+    std::filesystem::remove_all(directory);
+
+    return 0;
+}
@@ -0,0 +1,265 @@
+#!/bin/sh
+
+# Run every scenario of bench/scenarios on every combination of cluster size,
+# client count, payload size and client batch, and append one row per run to
+# a single CSV file.
+#
+# A scenario is a timeline of REPL commands, one `<seconds> <command>` per
+# line, the first one being START and the last one STOP. It is turned into a
+# REPL script which sleeps between the events and takes a METRICS json
+# snapshot right after each of them and every POLL seconds. Each run reports:
+#   THROUGHPUT  entries commited per second, from START to the last commit
+#   P50_MS      commit latency percentiles of the leaders at the end of the run
+#   P99_MS
+#   LEADER_MS   longest time from a CRASH to every group having a live leader
+#   CATCHUP_MS  longest time from a RECOVERY to the recovered server commiting
+#               everything the cluster had commited when it came back
+#   AGREE       whether the commited logs of the servers agree, checked by
+#               tools/check_logs
+#
+# Settings are taken from the environment, e.g.
+#   SERVERS="3 5" BATCHES="1 16" ./bench/sweep.sh bench/scenarios/steady.txt
+
+SERVERS=${SERVERS:-3 5}
+CLIENTS=${CLIENTS:-2}
+PAYLOADS=${PAYLOADS:-8 48}
+BATCHES=${BATCHES:-1 16}
+NCMD=${NCMD:-2000}
+POLL=${POLL:-0.25}
+OPTIONS=${OPTIONS:-}
+MPIRUN=${MPIRUN:-mpirun}
+RESULTS=${RESULTS:-sweep.csv}
+TIMEOUT=${TIMEOUT:-300}
+
+[ $# -eq 0 ] && set -- bench/scenarios/*.txt
+
+[ -x ./algorep ] && [ -x ./tools/check_logs ] \
+    || { echo "build algorep first: make algorep tools"; exit 1; }
+
+script=$(mktemp)
+marks=$(mktemp)
+trap 'rm -f "$script" "$marks"' EXIT
+
+# REPL script of the timeline on stdin, and the index of the snapshot taken
+# after each event in $marks
+expand()
+{
+    awk -v poll="$POLL" -v marks="$marks" '
+        {
+            time = $1
+            $1 = ""
+            command = substr($0, 2)
+
+            while (now + poll < time) {
+                print "SLEEP " poll
+                print "METRICS json"
+                now += poll
+                snapshots++
+            }
+
+            if (time > now)
+                print "SLEEP " time - now
+            now = time
+
+            print command
+
+            # Stopped servers do not answer
+            if (command != "STOP") {
+                print "METRICS json"
+                snapshots++
+                print snapshots, command > marks
+            }
+        }' | tr -s ' '
+}
+
+# Metrics of the run from metrics.jsonl and $marks, as CSV columns
+analyze()
+{
+    awk '
+        function field(text, key) {
+            if (!match(text, "\"" key "\":[^,}\\]]*"))
+                return ""
+            return substr(text, RSTART + length(key) + 3,
+                          RLENGTH - length(key) - 3)
+        }
+
+        FNR == NR {
+            mark = $1
+            $1 = ""
+            events[mark] = substr($0, 2)
+            next
+        }
+
+        {
+            n = FNR
+            time[n] = field($0, "time")
+            total[n] = 0
+
+            nb_servers = split($0, servers, /\{"rank":/)
+            for (i = 2; i <= nb_servers; i++) {
+                rank = servers[i] + 0
+                crashed = field(servers[i], "crashed") == "true"
+
+                nb_groups = split(servers[i], groups, /\{"group":/)
+                for (j = 2; j <= nb_groups; j++) {
+                    g = groups[j] + 0
+                    all_groups[g] = 1
+                    index_ = field(groups[j], "commit_index") + 0
+                    commit[n, rank, g] = index_
+
+                    if (index_ > best[n, g])
+                        best[n, g] = index_
+
+                    if (crashed)
+                        continue
+
+                    if (index_ > live[n, g])
+                        live[n, g] = index_
+
+                    if (field(groups[j], "leader") == "true") {
+                        leader[n, g] = rank
+                        p50[n] = max(p50[n], field(groups[j], "commit_p50"))
+                        p99[n] = max(p99[n], field(groups[j], "commit_p99"))
+                    }
+                }
+            }
+
+            for (g in all_groups)
+                total[n] += best[n, g]
+            last = n
+        }
+
+        function max(a, b) { return a + 0 > b + 0 ? a + 0 : b + 0 }
+
+        function elected(n,    g) {
+            for (g in all_groups)
+                if (!((n, g) in leader))
+                    return 0
+            return 1
+        }
+
+        function caught_up(n, rank, target,    g) {
+            for (g in all_groups)
+                if (commit[n, rank, g] < target[g])
+                    return 0
+            return 1
+        }
+
+        END {
+            start = 0
+            for (m in events)
+                if (events[m] ~ /^START/ && (!start || m + 0 < start))
+                    start = m + 0
+
+            if (!start || !last) {
+                print "-,-,-,-,-,-"
+                exit
+            }
+
+            end = start
+            for (n = start; n <= last; n++)
+                if (total[n] > total[end])
+                    end = n
+
+            committed = total[end] - total[start]
+            elapsed = time[end] - time[start]
+            throughput = elapsed > 0 ? committed / elapsed : 0
+
+            # Latencies of the last snapshot with a live leader
+            latest = last
+            while (latest > start && !p99[latest])
+                latest--
+
+            leader_ms = catchup_ms = "-"
+            for (m in events) {
+                split(events[m], words, " ")
+
+                if (words[1] == "CRASH") {
+                    n = m + 0
+                    while (n <= last && !elected(n))
+                        n++
+                    if (n <= last)
+                        leader_ms = max(leader_ms,
+                                        (time[n] - time[m]) * 1000)
+                }
+
+                if (words[1] == "RECOVERY" && words[2] != "") {
+                    delete target
+                    for (g in all_groups)
+                        target[g] = live[m, g]
+
+                    n = m + 0
+                    while (n <= last && !caught_up(n, words[2], target))
+                        n++
+                    if (n <= last)
+                        catchup_ms = max(catchup_ms,
+                                         (time[n] - time[m]) * 1000)
+                }
+            }
+
+            printf "%d,%.0f,%.2f,%.2f,%s,%s\n", committed, throughput,
+                   p50[latest] * 1000, p99[latest] * 1000, leader_ms,
+                   catchup_ms
+        }' "$marks" metrics.jsonl
+}
+
+# Whether the commited entries of the servers agree, a server still catching
+# up at the end of the run holds a prefix of the others
+agree()
+{
+    for first in committed_server1.bin committed_server1_*.bin; do
+        [ -e "$first" ] || continue
+        group=${first#committed_server1}
+
+        replicas=
+        for i in $(seq 1 "$1"); do
+            replicas="$replicas committed_server$i$group"
+        done
+
+        ./tools/check_logs $replicas > /dev/null || { echo no; return; }
+    done
+
+    echo yes
+}
+
+[ -e "$RESULTS" ] || echo "SCENARIO,SERVERS,CLIENTS,PAYLOAD,BATCH,COMMITTED,\
+THROUGHPUT,P50_MS,P99_MS,LEADER_MS,CATCHUP_MS,AGREE" > "$RESULTS"
+
+for scenario in "$@"; do
+    expand < "$scenario" > "$script"
+
+    for servers in $SERVERS; do
+    for clients in $CLIENTS; do
+    for payload in $PAYLOADS; do
+    for batch in $BATCHES; do
+        name=$(basename "$scenario" .txt)
+        echo "$name: $servers servers, $clients clients," \
+             "$payload bytes, batch $batch"
+
+        rm -f entries_server* log_server* committed_server* metrics.jsonl
+
+        # Commands are unique and padded to the payload size, at most 63 bytes
+        for i in $(seq $((servers + 1)) $((servers + clients))); do
+            awk -v rank="$i" -v n="$NCMD" -v size="$payload" 'BEGIN {
+                for (k = 1; k <= n; k++) {
+                    command = "c" rank "_" k
+                    while (length(command) < size)
+                        command = command "x"
+                    print command
+                }
+            }' > ".commands_$i.txt"
+            rm -f ".commands_$i.bin"
+        done
+
+        timeout "$TIMEOUT" $MPIRUN -np $((servers + clients + 1)) ./algorep \
+            "$servers" "$clients" client_batch="$batch" export_log=1 $OPTIONS \
+            < "$script" > /dev/null 2>&1
+
+        echo "$name,$servers,$clients,$payload,$batch,$(analyze),\
+$(agree "$servers")" >> "$RESULTS"
+        tail -1 "$RESULTS"
+    done
+    done
+    done
+    done
+done
@@ -1,12 +1,28 @@
 #!/bin/sh
 
-[ $# -ne 4 ] && { echo "usage: $0 NSERVER NCLIENT CMD_FILE NCMD"; exit 1; }
+BINARY=0
+[ "$1" = "-b" ] && { BINARY=1; shift; }
+
+[ $# -ne 4 ] && { echo "usage: $0 [-b] NSERVER NCLIENT CMD_FILE NCMD"; exit 1; }
 
 NSERVER=$1
 NCLIENT=$2
 CMD_FILE=$3
 NCMD=$4
 
+# Commands are drawn again once every one of the file was drawn
+REPEAT=
+[ "$NCMD" -gt "$(wc -l < "$CMD_FILE")" ] && REPEAT=-r
+
 for i in $(seq $((NSERVER + 1)) $((NCLIENT + NSERVER))); do
-    shuf -n $NCMD $CMD_FILE > ".commands_$i.txt"
+    # Clients read .commands_<rank>.bin first, only keep the format asked for
+    if [ $BINARY -eq 1 ]; then
+        shuf $REPEAT -n $NCMD $CMD_FILE | perl -ne \
+            'BEGIN { print "ALGOREP\x01" } chomp; print pack("V", length), $_' \
+            > ".commands_$i.bin"
+        rm -f ".commands_$i.txt"
+    else
+        shuf $REPEAT -n $NCMD $CMD_FILE > ".commands_$i.txt"
+        rm -f ".commands_$i.bin"
+    fi
 done
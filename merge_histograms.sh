@@ -0,0 +1,29 @@
+#!/bin/sh
+
+# Merge the latency histograms of several servers, written by the perf build,
+# and print the percentiles of the merged histograms in microseconds
+
+[ $# -eq 0 ] && set -- histograms_server*.csv
+[ -e "$1" ] || { echo "usage: $0 [histograms_server<rank>.csv...]"; exit 1; }
+
+awk -F, 'FNR > 1 { count[$1 "," $2 "," $3] += $4 }
+         END { for (bucket in count) print bucket "," count[bucket] }' "$@" \
+    | sort -t, -k1,1 -k2,2n \
+    | awk -F, '
+        function flush() {
+            if (name == "")
+                return
+            n = 0; p50 = p99 = p999 = ""
+            for (i = 1; i <= nb; i++) {
+                n += counts[i]
+                if (p50 == "" && n >= 0.5 * total) p50 = uppers[i]
+                if (p99 == "" && n >= 0.99 * total) p99 = uppers[i]
+                if (p999 == "" && n >= 0.999 * total) p999 = uppers[i]
+            }
+            printf "%s,%d,%.1f,%.1f,%.1f,%.1f\n", name, total, p50 / 1000,
+                   p99 / 1000, p999 / 1000, uppers[nb] / 1000
+        }
+        BEGIN { print "NAME,COUNT,P50_US,P99_US,P999_US,MAX_US" }
+        $1 != name { flush(); name = $1; nb = 0; total = 0 }
+        { nb++; uppers[nb] = $3; counts[nb] = $4; total += $4 }
+        END { flush() }'
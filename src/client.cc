@@ -1,7 +1,9 @@
 #include "client.hh"
 
+#include <algorithm>
 #include <assert.h>
 #include <chrono>
+#include <functional>
 #include <iostream>
 #include <thread>
 #include <unistd.h>
@@ -10,31 +12,23 @@
 #include "repl.hh"
 #include "rpc/rpc.hh"
 #include "server.hh"
+#include "utils/buffer.hh"
 
-namespace
-{
-    Client::command_list init_commands(std::string cmd_file)
-    {
-        Client::command_list res;
-
-        auto input = std::ifstream(cmd_file);
-
-        std::string line;
-        while (input >> line)
-            res.push_back(line);
-
-        return res;
-    }
-} // namespace
-
-Client::Client(int rank, int nb_server, std::string cmd_file)
+Client::Client(int rank, const Config& config, std::string cmd_file,
+               utils::Tracer& tracer)
     : rank_(rank)
-    , nb_server_(nb_server)
-    , server_(rank % nb_server + 1)
+    , nb_server_(config.nb_server)
+    , nb_group_(config.nb_group)
+    , leaders_(config.nb_group, rank % config.nb_voter + 1)
+    , batch_size_(config.client_batch)
+    , batch_bytes_(config.client_batch_bytes)
     , request_id_(0)
     , started_(false)
     , done_(false)
-    , command_list_(init_commands(cmd_file))
+    , commands_(cmd_file)
+    , pending_()
+    , sent_(0)
+    , tracer_(tracer)
     , mpi_()
 {
 #ifdef _DEBUG
@@ -52,11 +46,28 @@ void Client::send_request()
     if (done_)
         return;
 
-    rpc::ClientRequest message{rank_, request_id_, command_list_[request_id_]};
+    // Commands of a request which ran out of retries are sent again
+    if (pending_.empty())
+    {
+        pending_ = next_batch();
+        sent_ = utils::now().count();
+    }
+
+    if (pending_.empty())
+    {
+        done_ = true;
+        return;
+    }
+
+    auto& message = pending_;
+    int group = message.front().group;
+
+    // Leader of the group the request is routed to
+    auto& server = leaders_[group];
 
     utils::Timeout timeout(2, 2.6);
 
-    mpi_.send(server_, message, MessageTag::CLIENT_REQUEST);
+    mpi_.send(server, message, MessageTag::CLIENT_REQUEST);
 
     int count_retry = 0;
 
@@ -64,24 +75,54 @@ void Client::send_request()
     {
         if (timeout)
         {
-            server_ = server_ % nb_server_ + 1;
+            server = server % nb_server_ + 1;
 
-            mpi_.send(server_, message, MessageTag::CLIENT_REQUEST);
+            mpi_.send(server, message, MessageTag::CLIENT_REQUEST);
             timeout.reset();
 
             count_retry++;
         }
 
-        if (mpi_.available_message(server_))
+        if (mpi_.available_message(server))
         {
-            auto recv_data = mpi_.recv<rpc::ClientRequestResponse>(server_);
+            utils::Buffer buffer(mpi_.recv_vector<char>(server));
+            auto recv_data = buffer.pop<rpc::ClientRequestResponse>();
+            auto ids = buffer.pop_vector<unsigned>();
+
+            auto answered = [&ids](const rpc::ClientRequest& request) {
+                return std::find(ids.begin(), ids.end(), request.id)
+                    != ids.end();
+            };
+
+            // Late answer about another request, e.g. one of another group or
+            // commited after a retry was already answered
+            if (recv_data.group != group
+                || std::none_of(message.begin(), message.end(), answered))
+                continue;
+
+            if (recv_data.status
+                == rpc::ClientRequestResponse::Status::RETRY_AFTER)
+            {
+                // The leader is overloaded, not gone: wait as long as it asks
+                // and send the request to it again
+                std::this_thread::sleep_for(
+                    std::chrono::duration<double>(recv_data.retry_after));
 
-            if (!recv_data.value)
+                mpi_.send(server, message, MessageTag::CLIENT_REQUEST);
+                timeout.reset();
+            }
+
+            else if (recv_data.status
+                     == rpc::ClientRequestResponse::Status::REDIRECT)
             {
-                server_ = recv_data.leader;
-                std::this_thread::sleep_for(std::chrono::milliseconds(500));
+                // Follow the first redirection right away, back off when the
+                // server does not know any leader, e.g. during an election
+                if (recv_data.leader == server || count_retry)
+                    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+                server = recv_data.leader;
 
-                mpi_.send(server_, message, MessageTag::CLIENT_REQUEST);
+                mpi_.send(server, message, MessageTag::CLIENT_REQUEST);
                 timeout.reset();
 
                 count_retry++;
@@ -89,8 +130,23 @@ void Client::send_request()
 
             else
             {
-                request_id_++;
-                if (request_id_ >= command_list_.size())
+                // Commands of a batch may be commited in several rounds, only
+                // the remaining ones are sent again on a retry
+                if (tracer_.enabled())
+                {
+                    auto now = utils::now().count();
+                    for (const auto& request : message)
+                        if (answered(request)
+                            && tracer_.sampled(rank_, request.id))
+                            tracer_.span("request", rank_, request.id, sent_,
+                                         now);
+                }
+
+                std::erase_if(message, answered);
+                if (!message.empty())
+                    continue;
+
+                if (commands_.done())
                     done_ = true;
 
                 return;
@@ -100,6 +156,45 @@ void Client::send_request()
     }
 }
 
+std::vector<rpc::ClientRequest> Client::next_batch()
+{
+    std::vector<rpc::ClientRequest> batch;
+    std::size_t bytes = 0;
+
+    if (commands_.done())
+        return batch;
+
+    int group = route(*commands_.peek());
+
+    while (!commands_.done() && batch.size() < batch_size_)
+    {
+        auto command = *commands_.peek();
+
+        // A request only holds consecutive commands of a single group, so
+        // that each group still applies them in order
+        if (route(command) != group)
+            break;
+
+        if (batch_bytes_ && !batch.empty()
+            && bytes + command.size() > batch_bytes_)
+            break;
+
+        bytes += command.size();
+        batch.push_back(rpc::ClientRequest{
+            rank_, group, request_id_++,
+            rpc::command_t(command.data(), command.size())});
+
+        commands_.pop();
+    }
+
+    return batch;
+}
+
+int Client::route(std::string_view command) const
+{
+    return std::hash<std::string_view>{}(command) % nb_group_;
+}
+
 bool Client::started()
 {
     return started_;
@@ -112,11 +207,15 @@ bool Client::recv_order()
     if (!tag)
         return false;
 
-    auto recv_data = mpi_.recv<rpc::Repl>();
+    auto recv_data = mpi_.recv<rpc::Repl>(tag->MPI_SOURCE, MessageTag::REPL);
 
     if (recv_data.order == Repl::Order::STOP)
         done_ = true;
     else if (recv_data.order == Repl::Order::BEGIN)
         started_ = true;
+    else if (recv_data.order == Repl::Order::NETWORK)
+        mpi_.set_link(recv_data.source, recv_data.faults);
+    else if (recv_data.order == Repl::Order::PARTITION)
+        mpi_.set_partitioned(recv_data.source, recv_data.partitioned);
     return true;
 }
@@ -2,18 +2,22 @@
 
 #include <mpi.h>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include "common.hh"
+#include "config.hh"
 #include "mpi/mpi.hh"
+#include "rpc/rpc.hh"
+#include "utils/command_reader.hh"
 #include "utils/time.hh"
+#include "utils/trace.hh"
 
 class Client
 {
 public:
-    using command_list = std::vector<std::string>;
-
-    Client(rank rank, int nb_server, std::string cmd_file);
+    Client(rank rank, const Config& config, std::string cmd_file,
+           utils::Tracer& tracer);
 
     bool done() const;
     void send_request();
@@ -21,14 +25,35 @@ public:
     bool recv_order();
 
 private:
+    /// Next commands of the workload, up to the batch limits
+    std::vector<rpc::ClientRequest> next_batch();
+
+    /// Group in charge of `command`
+    int route(std::string_view command) const;
+
     rank rank_;
     int nb_server_;
-    int server_;
+    int nb_group_;
+
+    /// Last known leader of each group
+    std::vector<rank> leaders_;
+
+    /// Limits of the commands and bytes of commands sent in one request
+    std::size_t batch_size_;
+    std::size_t batch_bytes_;
 
     unsigned request_id_;
     bool started_;
     bool done_;
 
-    command_list command_list_;
+    utils::CommandReader commands_;
+
+    /// Commands sent and not commited yet
+    std::vector<rpc::ClientRequest> pending_;
+
+    /// Time the pending commands were first sent
+    double sent_;
+
+    utils::Tracer& tracer_;
     mpi::Mpi mpi_;
 };
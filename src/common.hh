@@ -11,6 +11,15 @@ enum MessageTag
     VOTE,
     CLIENT_REQUEST,
     CLIENT_REQUEST_RESPONSE,
+    HEARTBEAT,
+    HEARTBEAT_RESPONSE,
+    PRE_VOTE,
+    PRE_VOTE_RESPONSE,
+    TIMEOUT_NOW,
+    HEARTBEAT_RELAY,
+    HEARTBEAT_RELAY_RESPONSE,
+    APPEND_ENTRIES_BATCH,
+    METRICS,
     REPL,
 };
 
@@ -30,6 +39,24 @@ inline std::string tag_to_str(int tag)
         return "CLIENT_REQUEST";
     case MessageTag::CLIENT_REQUEST_RESPONSE:
         return "CLIENT_REQUEST_RESPONSE";
+    case MessageTag::HEARTBEAT:
+        return "HEARTBEAT";
+    case MessageTag::HEARTBEAT_RESPONSE:
+        return "HEARTBEAT_RESPONSE";
+    case MessageTag::PRE_VOTE:
+        return "PRE_VOTE";
+    case MessageTag::PRE_VOTE_RESPONSE:
+        return "PRE_VOTE_RESPONSE";
+    case MessageTag::TIMEOUT_NOW:
+        return "TIMEOUT_NOW";
+    case MessageTag::HEARTBEAT_RELAY:
+        return "HEARTBEAT_RELAY";
+    case MessageTag::HEARTBEAT_RELAY_RESPONSE:
+        return "HEARTBEAT_RELAY_RESPONSE";
+    case MessageTag::APPEND_ENTRIES_BATCH:
+        return "APPEND_ENTRIES_BATCH";
+    case MessageTag::METRICS:
+        return "METRICS";
     case MessageTag::REPL:
         return "REPL";
     default:
@@ -37,5 +64,42 @@ inline std::string tag_to_str(int tag)
     }
 }
 
+/// Messages travel on separate channels so that elections, heartbeats and
+/// orders never wait behind replication traffic
+enum Channel
+{
+    CONTROL = 0,
+    DATA,
+    NB_CHANNEL,
+};
+
+inline Channel tag_channel(int tag)
+{
+    switch (tag)
+    {
+    case MessageTag::APPEND_ENTRIES:
+    case MessageTag::APPEND_ENTRIES_RESPONSE:
+    case MessageTag::APPEND_ENTRIES_BATCH:
+    case MessageTag::CLIENT_REQUEST:
+    case MessageTag::CLIENT_REQUEST_RESPONSE:
+        return Channel::DATA;
+    default:
+        return Channel::CONTROL;
+    }
+}
+
+inline std::string channel_to_str(int channel)
+{
+    switch (channel)
+    {
+    case Channel::CONTROL:
+        return "CONTROL";
+    case Channel::DATA:
+        return "DATA";
+    default:
+        return "";
+    }
+}
+
 /// follower rank:monrank_
 using rank = int;
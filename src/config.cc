@@ -0,0 +1,165 @@
+#include "config.hh"
+
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+
+#include "rpc/rpc.hh"
+
+namespace
+{
+    /// Largest message MPI sends, whose size is an int
+    constexpr std::size_t max_message_size = std::numeric_limits<int>::max();
+
+    /// Set `field` from `value`, return false if it is not a valid number
+    template <typename T>
+    bool parse_field(T& field, const std::string& value)
+    {
+        try
+        {
+            std::size_t end;
+            if constexpr (std::is_same_v<T, bool>)
+            {
+                // Flags are set with 1 and cleared with 0, nothing else
+                if (value != "0" && value != "1")
+                    return false;
+                field = value == "1";
+                return true;
+            }
+            else if constexpr (std::is_floating_point_v<T>)
+                field = std::stod(value, &end);
+            else if constexpr (std::is_same_v<T, std::size_t>)
+            {
+                // stoull negates negative numbers instead of rejecting them
+                if (value.find('-') != std::string::npos)
+                    return false;
+                field = std::stoull(value, &end);
+            }
+            else
+                field = std::stoi(value, &end);
+
+            return end == value.size();
+        }
+        catch (const std::logic_error&)
+        {
+            return false;
+        }
+    }
+} // namespace
+
+std::optional<Config> Config::parse(int argc, char* argv[])
+{
+    if (argc < 3)
+        return {};
+
+    Config config;
+
+    if (!parse_field(config.nb_server, argv[1])
+        || !parse_field(config.nb_client, argv[2]))
+        return {};
+
+    for (int i = 3; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        auto pos = arg.find('=');
+
+        if (pos == std::string::npos)
+            return {};
+
+        auto key = arg.substr(0, pos);
+        auto value = arg.substr(pos + 1);
+
+        bool valid = false;
+
+        if (key == "groups")
+            valid = parse_field(config.nb_group, value) && config.nb_group > 0;
+        else if (key == "voters")
+            valid = parse_field(config.nb_voter, value) && config.nb_voter > 0
+                && config.nb_voter <= config.nb_server;
+        else if (key == "heartbeat_min")
+            valid = parse_field(config.heartbeat_min, value);
+        else if (key == "heartbeat_max")
+            valid = parse_field(config.heartbeat_max, value);
+        else if (key == "election_min")
+            valid = parse_field(config.election_min, value);
+        else if (key == "election_max")
+            valid = parse_field(config.election_max, value);
+        else if (key == "fanout")
+            valid = parse_field(config.fanout, value) && config.fanout >= 0;
+        else if (key == "compress")
+            valid = parse_field(config.compress, value)
+                && config.compress <= max_message_size;
+        else if (key == "max_uncommitted")
+            valid = parse_field(config.max_uncommitted, value)
+                && config.max_uncommitted >= 0;
+        else if (key == "max_uncommitted_bytes")
+            valid = parse_field(config.max_uncommitted_bytes, value)
+                && config.max_uncommitted_bytes <= max_message_size;
+        else if (key == "client_batch")
+            valid = parse_field(config.client_batch, value)
+                && config.client_batch > 0
+                && static_cast<std::size_t>(config.client_batch)
+                    <= max_message_size / sizeof(rpc::ClientRequest);
+        else if (key == "client_batch_bytes")
+            valid = parse_field(config.client_batch_bytes, value)
+                && config.client_batch_bytes <= max_message_size;
+        else if (key == "trace")
+            valid = parse_field(config.trace, value) && config.trace >= 0;
+        else if (key == "export_log")
+            valid = parse_field(config.export_log, value);
+        else if (key == "fsync")
+            valid = parse_field(config.fsync, value);
+
+        if (!valid)
+            return {};
+    }
+
+    if (config.heartbeat_min <= 0
+        || config.heartbeat_min > config.heartbeat_max
+        || config.election_min <= 0
+        || config.election_min > config.election_max)
+        return {};
+
+    if (!config.nb_voter)
+        config.nb_voter = config.nb_server;
+
+    return config;
+}
+
+std::string Config::usage(const std::string& name)
+{
+    return "usage: " + name + " nb_server nb_client [option=value...]\n"
+        + "options:\n"
+        + "  groups=N            number of consensus groups per server "
+          "(default 1)\n"
+        + "  voters=N            servers initially in each group, the others "
+          "are spares (default nb_server)\n"
+        + "  heartbeat_min=S     lowest heartbeat interval in seconds "
+          "(default 0.01)\n"
+        + "  heartbeat_max=S     highest heartbeat interval in seconds "
+          "(default 0.1)\n"
+        + "  election_min=S      lowest election timeout in seconds "
+          "(default 0.1)\n"
+        + "  election_max=S      highest election timeout in seconds "
+          "(default 0.5)\n"
+        + "  fanout=K            relay heartbeats through a K-ary tree "
+          "(default 0, off)\n"
+        + "  compress=B          compress batches of entries of at least B "
+          "bytes (default 0, off)\n"
+        + "  max_uncommitted=N   entries a leader holds uncommited before "
+          "throttling clients (default 0, no limit)\n"
+        + "  max_uncommitted_bytes=B\n"
+          "                      same limit on payload bytes (default 0, "
+          "no limit)\n"
+        + "  client_batch=K      commands sent by a client in a single "
+          "request (default 1)\n"
+        + "  client_batch_bytes=B\n"
+          "                      bytes of commands in a single request "
+          "(default 0, no limit)\n"
+        + "  trace=N             trace one request in N to trace.json "
+          "(default 0, off)\n"
+        + "  export_log=1        export commited entries to "
+          "committed_server<rank>.bin (default 0)\n"
+        + "  fsync=1             sync log entries and votes to disk before "
+          "they count (default 0)\n";
+}
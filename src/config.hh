@@ -0,0 +1,66 @@
+#pragma once
+
+#include <optional>
+#include <string>
+
+/// Runtime configuration shared by every process of the system
+struct Config
+{
+    /// Number of server processes
+    int nb_server;
+
+    /// Number of servers in the initial configuration of each group, the
+    /// others are started idle as spares to be added at runtime
+    int nb_voter = 0;
+
+    /// Number of client processes
+    int nb_client;
+
+    /// Number of independent consensus groups hosted by each server
+    int nb_group = 1;
+
+    /// Limits of the heartbeat interval, adapted to the measured round trip
+    /// times, in seconds
+    double heartbeat_min = 0.01;
+    double heartbeat_max = 0.1;
+
+    /// Limits of the lower bound of the election timeout, adapted to the
+    /// heartbeat interval of the leader, in seconds
+    double election_min = 0.1;
+    double election_max = 0.5;
+
+    /// Number of children of each node of the tree heartbeats are relayed
+    /// through, 0 to send them directly to every server
+    int fanout = 0;
+
+    /// Size in bytes from which batches of entries are compressed, 0 to never
+    /// compress them
+    std::size_t compress = 0;
+
+    /// Limits of the entries and payload bytes a leader holds uncommited
+    /// before asking clients to retry later, 0 for no limit
+    int max_uncommitted = 0;
+    std::size_t max_uncommitted_bytes = 0;
+
+    /// Limits of the commands and bytes of commands a client packs in a
+    /// single request, 0 for no limit on bytes
+    int client_batch = 1;
+    std::size_t client_batch_bytes = 0;
+
+    /// Trace one client request in this many, 0 to trace none
+    int trace = 0;
+
+    /// Export the commited entries of each group in binary, for
+    /// tools/check_logs
+    bool export_log = false;
+
+    /// Sync log entries and votes to disk before they count, instead of
+    /// only writing them to the page cache
+    bool fsync = false;
+
+    /// Parse `nb_server nb_client [option=value...]` from the command line
+    static std::optional<Config> parse(int argc, char* argv[]);
+
+    /// Usage string describing the accepted arguments
+    static std::string usage(const std::string& name);
+};
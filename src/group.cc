@@ -0,0 +1,1555 @@
+#include "group.hh"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "utils/buffer.hh"
+#include "utils/lz4.hh"
+
+#define LOG(mode)                                                              \
+    logger_ << utils::Logger::LogType::mode << "group " << id_ << ": "
+
+namespace
+{
+    /// Number of heartbeat intervals without news from the leader before
+    /// starting an election
+    constexpr double election_heartbeat_ratio = 5;
+
+    /// Largest number of entries sent in a single batch
+    constexpr std::size_t max_batch_entries = 256;
+
+    /// Largest number of sampled entries kept for tracing, entries commited
+    /// but never acknowledged by a crashed server are dropped past it
+    constexpr std::size_t max_traced_entries = 1024;
+
+    /// `<name>_server<rank>[_<id>]<extension>`
+    std::string group_file(const std::string& name, int id, rank rank,
+                           const std::string& extension)
+    {
+        auto file = name + "_server" + std::to_string(rank);
+
+        // Keep the historical file name for the first group
+        if (id)
+            file += "_" + std::to_string(id);
+
+        return file + extension;
+    }
+} // namespace
+
+//------------------------------------------------------------------//
+//                           Constructor                            //
+//------------------------------------------------------------------//
+
+Group::Group(int id, rank rank, const Config& config, mpi::Mpi& mpi,
+             utils::Logger& logger, utils::Tracer& tracer)
+    : id_(id)
+    , status_(Status::FOLLOWER)
+    , rank_(rank)
+    , nb_server_(config.nb_server)
+    , leader_(rank)
+    , timeout_(config.election_max, 2 * config.election_max)
+    , election_min_(config.election_min)
+    , election_max_(config.election_max)
+    , preferred_(id % config.nb_voter + 1 == rank)
+    , heartbeat_interval_(config.heartbeat_max)
+    , term_(0)
+    , voted_for_(-1)
+    , votes_(config.nb_server + 1)
+    , last_leader_contact_()
+    , recent_contact_(config.nb_server + 1)
+    , transfer_target_(-1)
+    , stats_()
+    , timings_()
+    , arrivals_()
+    , replies_()
+    , traced_()
+    , traced_replies_()
+    , election_start_(utils::now().count())
+    , next_index_(config.nb_server + 1)
+    , commit_index_(config.nb_server + 1)
+    , batch_in_flight_(config.nb_server + 1)
+    , compress_min_(config.compress)
+    , max_uncommitted_(config.max_uncommitted)
+    , max_uncommitted_bytes_(config.max_uncommitted_bytes)
+    , log_entries_(group_file("entries", id, rank, ".log"), config.fsync)
+    , state_(group_file("state", id, rank, ".bin"), config.fsync)
+    , match_index_(config.nb_server)
+    , configurations_{
+          {-1, utils::Membership(config.nb_server, config.nb_voter)}}
+    , membership_orders_()
+    , logger_(logger)
+    , tracer_(tracer)
+    , mpi_(mpi)
+{
+    set_election_timeout(heartbeat_interval_);
+    timeout_.reset();
+
+    match_index_.set_voters(membership().voters());
+
+    if (config.export_log)
+        log_entries_.export_committed(
+            group_file("committed", id, rank, ".bin"));
+}
+
+//------------------------------------------------------------------//
+//                          Main functions                          //
+//------------------------------------------------------------------//
+
+void Group::update()
+{
+    // The writes of the leader go on while it replicates its entries
+    if (status_ == Status::LEADER)
+    {
+        update_own_match();
+        change_membership();
+    }
+
+    if (!timeout_)
+        return;
+
+    if (status_ == Status::LEADER)
+        check_quorum();
+    else if (membership().voter(rank_))
+        start_pre_vote();
+    else
+        timeout_.reset();
+}
+
+std::optional<rpc::AppendEntries> Group::heartbeat(rank server)
+{
+    if (!membership().member(server) || replicate(server))
+        return {};
+
+    LOG(INFO) << "server: " << server << " is up to date, next_index is "
+              << next_index_[server];
+
+    return heartbeat_message(next_index_[server]);
+}
+
+rpc::AppendEntries Group::relayed_heartbeat()
+{
+    return heartbeat_message(log_entries_.last_log_index() + 1);
+}
+
+bool Group::replicate(rank server)
+{
+    if (!membership().member(server)
+        || next_index_[server] > log_entries_.last_log_index())
+        return false;
+
+    // Several entries are sent in batches, one at a time, sealed ones are
+    // streamed from the mapped segment
+    auto range = log_entries_.range(next_index_[server], max_batch_entries);
+    if (range && (range->sealed || range->nb_entries > 1))
+    {
+        if (batch_in_flight_[server])
+            return false;
+
+        send_batch(server, *range);
+        return true;
+    }
+
+    auto message = heartbeat_message(next_index_[server]);
+
+    auto next_entry = log_entries_[next_index_[server]];
+    message.entry = next_entry.data;
+    message.entry_term = next_entry.term;
+
+    LOG(INFO) << "Sending append entries to " << server
+              << ", client_id: " << next_entry.data.source
+              << ", request_id: " << next_entry.data.id
+              << ", entry_command: " << message.entry->command
+              << ", term: " << term_
+              << ", prev_log_index: " << message.prev_log_index
+              << ", prev_log_term: " << message.prev_log_term;
+
+    mpi_.send(server, message, MessageTag::APPEND_ENTRIES);
+    trace_sent(server, next_index_[server], next_index_[server]);
+
+    return true;
+}
+
+bool Group::is_leader() const
+{
+    return status_ == Status::LEADER;
+}
+
+const Group::Stats& Group::stats() const
+{
+    return stats_;
+}
+
+const Group::Timings& Group::timings() const
+{
+    return timings_;
+}
+
+std::vector<utils::LogEntries::SegmentStats> Group::memory() const
+{
+    return log_entries_.memory();
+}
+
+void Group::set_heartbeat_interval(double interval)
+{
+    heartbeat_interval_ = interval;
+
+    // The leader uses the election timeout to check the quorum
+    if (status_ == Status::LEADER)
+        set_election_timeout(interval);
+}
+
+//------------------------------------------------------------------//
+//                         Leader functions                         //
+//------------------------------------------------------------------//
+
+rpc::AppendEntries Group::heartbeat_message(int next_index)
+{
+    rpc::AppendEntries message{rank_,
+                               id_,
+                               term_,
+                               leader_,
+                               -1,
+                               -1,
+                               {},
+                               -1,
+                               log_entries_.get_commit_index(),
+                               utils::now().count(),
+                               heartbeat_interval_};
+
+    message.prev_log_index = next_index - 1;
+    message.prev_log_term =
+        next_index - 1 < 0 ? -1 : log_entries_.term(next_index - 1);
+
+    return message;
+}
+
+void Group::init_next_index()
+{
+    int last_index = log_entries_.last_log_index();
+    for (int i = 1; i <= nb_server_; i++)
+        next_index_[i] = last_index + 1;
+}
+
+void Group::init_commit_index()
+{
+    for (int i = 1; i <= nb_server_; i++)
+        commit_index_[i] = -1;
+}
+
+void Group::check_quorum()
+{
+    timeout_.reset();
+
+    if (transfer_target_ != -1)
+    {
+        LOG(INFO) << "leadership transfer to " << transfer_target_
+                  << " timed out";
+        transfer_target_ = -1;
+    }
+
+    // A leader removing itself manages the group without being part of it
+    int nb_alive = membership().voter(rank_);
+    for (int i = 1; i <= nb_server_; i++)
+        if (i != rank_ && membership().voter(i) && recent_contact_[i])
+            nb_alive++;
+
+    std::fill(recent_contact_.begin(), recent_contact_.end(), false);
+
+    if (membership().majority(nb_alive))
+        return;
+
+    LOG(INFO) << "lost contact with the majority, stepping down";
+    status_ = Status::FOLLOWER;
+    stats_.step_downs++;
+}
+
+void Group::continue_transfer()
+{
+    // Not up to date yet, send the next entry right away instead of waiting
+    // for the next heartbeat
+    if (next_index_[transfer_target_] <= log_entries_.last_log_index())
+    {
+        if (auto message = heartbeat(transfer_target_))
+            mpi_.send(transfer_target_, *message, MessageTag::APPEND_ENTRIES);
+        return;
+    }
+
+    LOG(INFO) << "transferring leadership to " << transfer_target_;
+
+    rpc::TimeoutNow message{rank_, id_, term_};
+    mpi_.send(transfer_target_, message, MessageTag::TIMEOUT_NOW);
+
+    status_ = Status::FOLLOWER;
+    leader_ = transfer_target_;
+    transfer_target_ = -1;
+    timeout_.reset();
+    stats_.transfers++;
+}
+
+void Group::send_batch(rank server, const utils::LogEntries::Range& range)
+{
+    auto headers_size = range.nb_entries * sizeof(*range.headers);
+
+    rpc::AppendEntriesBatch batch{
+        heartbeat_message(next_index_[server]),
+        static_cast<int>(range.nb_entries),
+        static_cast<std::uint32_t>(range.payload_size), 0};
+
+    LOG(INFO) << "Sending " << range.nb_entries << " entries to " << server
+              << " from index " << next_index_[server];
+
+    auto raw_size = headers_size + range.payload_size;
+
+    trace_sent(server, next_index_[server],
+               next_index_[server] + range.nb_entries - 1);
+
+    if (compress_min_ && raw_size >= compress_min_)
+    {
+        auto start = utils::now();
+
+        std::vector<char> raw(raw_size);
+        std::memcpy(raw.data(), range.headers, headers_size);
+        std::memcpy(raw.data() + headers_size, range.payload,
+                    range.payload_size);
+
+        std::vector<char> compressed;
+        utils::lz4_compress(raw.data(), raw_size, compressed);
+
+        stats_.compress_time += (utils::now() - start).count();
+
+        // Not worth it, e.g. random payloads
+        if (compressed.size() < raw_size)
+        {
+            batch.compressed_size = compressed.size();
+
+            stats_.compressed_batches++;
+            stats_.raw_bytes += raw_size;
+            stats_.compressed_bytes += compressed.size();
+
+            utils::Buffer head;
+            head.push(batch);
+
+            auto bytes = head.bytes();
+            bytes.insert(bytes.end(), compressed.begin(), compressed.end());
+
+            mpi_.send_ranges(server, std::move(bytes), {},
+                             MessageTag::APPEND_ENTRIES_BATCH);
+
+            batch_in_flight_[server] = true;
+            return;
+        }
+    }
+
+    utils::Buffer head;
+    head.push(batch);
+
+    // Segments in memory may be reused before the send completes, their
+    // entries are copied
+    if (!range.sealed)
+    {
+        auto bytes = head.bytes();
+        auto headers = reinterpret_cast<const char*>(range.headers);
+        bytes.insert(bytes.end(), headers, headers + headers_size);
+        bytes.insert(bytes.end(), range.payload,
+                     range.payload + range.payload_size);
+
+        mpi_.send_ranges(server, std::move(bytes), {},
+                         MessageTag::APPEND_ENTRIES_BATCH);
+    }
+    // The mapping stays valid until the send completes, even if the segment
+    // is dropped or read back meanwhile
+    else
+        mpi_.send_ranges(server, head.bytes(),
+                         {{range.headers, headers_size},
+                          {range.payload, range.payload_size}},
+                         MessageTag::APPEND_ENTRIES_BATCH, range.sealed);
+
+    batch_in_flight_[server] = true;
+}
+
+void Group::advance_commit_index()
+{
+    int index = match_index_.index();
+
+    auto now = utils::now().count();
+    for (auto& arrival : arrivals_)
+    {
+        if (arrival.index > index)
+            break;
+
+        if (!arrival.quorum)
+            timings_.quorum.record(now - arrival.received);
+        arrival.quorum = true;
+    }
+
+    for (auto& traced : traced_)
+    {
+        if (traced.index > index)
+            break;
+
+        if (!traced.quorum)
+        {
+            traced.quorum = now;
+            tracer_.span("replicate", traced.client, traced.id,
+                         traced.appended, now);
+        }
+    }
+
+    // Entries of previous terms are only commited along with an entry of the
+    // current term, a majority of their copies may still be overwritten
+    if (index <= log_entries_.get_commit_index()
+        || log_entries_.term(index) != term_)
+        return;
+
+    for (int i = log_entries_.get_commit_index() + 1; i <= index; i++)
+        commit_entry(i, log_entries_[i].data);
+
+    persist();
+}
+
+void Group::update_own_match()
+{
+    if (match_index_.update(rank_, log_entries_.durable_index()))
+        advance_commit_index();
+}
+
+void Group::change_membership()
+{
+    using Role = utils::Membership::Role;
+
+    int index = configurations_.back().first;
+    int commit = log_entries_.get_commit_index();
+
+    // One change at a time, so that the majorities of two successive
+    // configurations always overlap. The configuration of the previous
+    // leader is only final once an entry of this term is commited.
+    if (index > commit || commit < 0 || log_entries_.term(commit) != term_)
+        return;
+
+    auto membership = this->membership();
+
+    if (!membership.voter(rank_))
+    {
+        LOG(INFO) << "removed from the group, stepping down";
+        status_ = Status::FOLLOWER;
+        stats_.step_downs++;
+        return;
+    }
+
+    // Learners are promoted first, they are not counted in any majority
+    // until then
+    for (rank server = 1; server <= nb_server_; server++)
+    {
+        if (membership.role(server) == Role::LEARNER
+            && match_index_.match(server) >= commit)
+        {
+            LOG(INFO) << "learner " << server << " caught up";
+            membership.set(server, Role::VOTER);
+            return propose_membership(membership);
+        }
+    }
+
+    while (!membership_orders_.empty())
+    {
+        auto [server, role] = membership_orders_.front();
+        membership_orders_.pop_front();
+
+        // Adding a member or removing a server which is not one does nothing
+        if (membership.member(server) == (role == Role::LEARNER))
+            continue;
+
+        if (membership.voter(server) && membership.nb_voter() == 1)
+        {
+            LOG(INFO) << "cannot remove the last voter " << server;
+            continue;
+        }
+
+        if (role == Role::LEARNER)
+        {
+            // Entries are sent from the end of the log, the learner tells
+            // where its own ends
+            next_index_[server] = log_entries_.last_log_index() + 1;
+            commit_index_[server] = -1;
+            batch_in_flight_[server] = false;
+        }
+
+        membership.set(server, role);
+        return propose_membership(membership);
+    }
+}
+
+void Group::propose_membership(const utils::Membership& membership)
+{
+    // Ids only make the entry unique, the log does not append duplicates
+    auto index = log_entries_.last_log_index() + 1;
+    append_entries(term_,
+                   rpc::ClientRequest{rpc::config_client, id_,
+                                      static_cast<unsigned>(index),
+                                      membership.encode()});
+
+    update_own_match();
+}
+
+void Group::commit_entry(int log_index, const rpc::ClientRequest& request)
+{
+    log_entries_.commit_next_entry();
+    LOG(INFO) << "commited log number: " << log_index;
+
+    // Entries of previous leaders were not received by this one
+    if (!arrivals_.empty() && arrivals_.front().index == log_index)
+    {
+        auto received = arrivals_.front().received;
+        timings_.commit.record(utils::now().count() - received);
+        replies_.push_back(received);
+        arrivals_.pop_front();
+    }
+
+    // Sampled entries are kept until every follower acknowledged them
+    for (auto& traced : traced_)
+    {
+        if (traced.index > log_index)
+            break;
+
+        if (traced.index == log_index)
+        {
+            traced.committed = utils::now().count();
+            tracer_.span("commit", traced.client, traced.id, traced.quorum,
+                         traced.committed);
+            traced_replies_.push_back(traced);
+        }
+    }
+
+    if (!rpc::internal_entry(request.source))
+        notifications_[request.source].push_back(request.id);
+
+    record_id(applied_ids_, log_index);
+}
+
+bool Group::known_id(const std::unordered_map<rank, unsigned>& ids,
+                     rank client, unsigned id)
+{
+    auto last = ids.find(client);
+    return last != ids.end() && id <= last->second;
+}
+
+void Group::record_id(std::unordered_map<rank, unsigned>& ids, int index)
+{
+    const auto& header = log_entries_.header(index);
+
+    if (rpc::internal_entry(header.client))
+        return;
+
+    auto [last, inserted] = ids.try_emplace(header.client, header.id);
+    last->second = std::max(last->second, header.id);
+}
+
+void Group::flush_notifications()
+{
+    rpc::ClientRequestResponse message{
+        rank_, id_, rpc::ClientRequestResponse::Status::COMMITTED, leader_, 0};
+
+    // Vectors are cleared rather than erased to keep their capacity
+    for (auto& [client, ids] : notifications_)
+    {
+        if (ids.empty())
+            continue;
+
+        LOG(INFO) << "Notify client " << client << " for " << ids.size()
+                  << " requests";
+
+        send_client_response(client, message, ids);
+        ids.clear();
+    }
+
+    auto now = utils::now().count();
+    for (auto received : replies_)
+        timings_.reply.record(now - received);
+    replies_.clear();
+
+    for (const auto& traced : traced_replies_)
+        tracer_.span("reply", traced.client, traced.id, traced.committed, now);
+    traced_replies_.clear();
+
+    auto acknowledged = [this](const Traced& traced) {
+        for (rank server = 1; server <= nb_server_; server++)
+            if (server != rank_ && membership().member(server)
+                && traced.sent[server] >= 0)
+                return false;
+        return true;
+    };
+
+    while (!traced_.empty() && traced_.front().committed
+           && (acknowledged(traced_.front())
+               || traced_.size() > max_traced_entries))
+        traced_.pop_front();
+}
+
+bool Group::admit_client(const std::vector<rpc::ClientRequest>& recv_data)
+{
+    int new_entries = recv_data.size();
+
+    // Without limits, every request is admitted and the pipeline is not
+    // measured
+    if (!max_uncommitted_ && !max_uncommitted_bytes_)
+    {
+        stats_.admitted += new_entries;
+        return true;
+    }
+
+    int entries =
+        log_entries_.last_log_index() - log_entries_.get_commit_index();
+    auto bytes = log_entries_.uncommitted_bytes();
+
+    std::size_t new_bytes = 0;
+    for (const auto& request : recv_data)
+        new_bytes += request.command.size();
+
+    // An empty pipeline always accepts a request, whatever its size
+    bool full = entries > 0
+        && ((max_uncommitted_ && entries + new_entries > max_uncommitted_)
+            || (max_uncommitted_bytes_
+                && bytes + new_bytes > max_uncommitted_bytes_));
+
+    if (!full)
+    {
+        stats_.admitted += new_entries;
+        stats_.max_uncommitted =
+            std::max(stats_.max_uncommitted, entries + new_entries);
+        stats_.max_uncommitted_bytes =
+            std::max(stats_.max_uncommitted_bytes, bytes + new_bytes);
+        return true;
+    }
+
+    stats_.throttled += new_entries;
+
+    // Entries are commited about one round trip after being sent, which the
+    // heartbeat interval follows
+    rpc::ClientRequestResponse message{
+        rank_, id_, rpc::ClientRequestResponse::Status::RETRY_AFTER, rank_,
+        heartbeat_interval_};
+    send_client_response(recv_data.front().source, message,
+                         request_ids(recv_data));
+
+    LOG(INFO) << "throttling client " << recv_data.front().source << ", "
+              << entries << " entries and " << bytes << " bytes uncommited";
+    return false;
+}
+
+//------------------------------------------------------------------//
+//                        Follower functions                        //
+//------------------------------------------------------------------//
+
+void Group::reject_client(const std::vector<rpc::ClientRequest>& recv_data)
+{
+    auto leader = transfer_target_ != -1 ? transfer_target_ : leader_;
+
+    rpc::ClientRequestResponse message{
+        rank_, id_, rpc::ClientRequestResponse::Status::REDIRECT, leader, 0};
+    send_client_response(recv_data.front().source, message,
+                         request_ids(recv_data));
+}
+
+void Group::update_commit_index(int index)
+{
+    while (index > log_entries_.get_commit_index())
+    {
+        if (!log_entries_.commit_next_entry())
+            break;
+        LOG(INFO) << "commited log number: "
+                  << log_entries_.get_commit_index() + 1;
+
+        record_id(applied_ids_, log_entries_.get_commit_index());
+    }
+
+    persist();
+}
+
+void Group::truncate_log(int index)
+{
+    log_entries_.delete_from_index(index);
+
+    if (configurations_.back().first < index)
+        return;
+
+    // The initial configuration is never removed
+    while (configurations_.back().first >= index)
+        configurations_.pop_back();
+
+    update_membership();
+}
+
+bool Group::accept_append_entries(const rpc::AppendEntries& recv_data,
+                                  rpc::AppendEntriesResponse& message)
+{
+    // A new leader may not know yet of the entries commited by the previous
+    // one, only its term matters
+    if (recv_data.term < term_)
+    {
+        LOG(INFO) << "rejecting append entries term:" << recv_data.term << "|"
+                  << term_;
+        return false;
+    }
+
+    leader_ = recv_data.source;
+    status_ = Status::FOLLOWER;
+    set_election_timeout(recv_data.heartbeat_interval);
+    timeout_.reset();
+    last_leader_contact_ = utils::now();
+
+    int prev = recv_data.prev_log_index;
+
+    if (prev > log_entries_.last_log_index())
+    {
+        LOG(INFO) << "rejecting append entries, prev log_index : " << prev
+                  << "|" << log_entries_.last_log_index();
+
+        message.log_index = log_entries_.last_log_index();
+        return false;
+    }
+
+    // Entries of dropped segments are commited, the same on every server
+    if (prev < log_entries_.first_log_index()
+        || log_entries_.term(prev) == recv_data.prev_log_term)
+        return true;
+
+    // The whole term of the conflicting entry is skipped at once, the leader
+    // sends its entries from there
+    int conflict = log_entries_.term(prev);
+    int index = prev;
+    while (index - 1 > log_entries_.get_commit_index()
+           && index - 1 >= log_entries_.first_log_index()
+           && log_entries_.term(index - 1) == conflict)
+        index--;
+
+    LOG(INFO) << "rejecting append entries, prev log_index: " << prev
+              << " log term: " << recv_data.prev_log_term << "|" << conflict
+              << ", conflict from " << index;
+
+    message.log_index = index - 1;
+    return false;
+}
+
+//------------------------------------------------------------------//
+//                            Elections                             //
+//------------------------------------------------------------------//
+
+void Group::vote(int server)
+{
+    LOG(INFO) << "voting for " << server;
+    timeout_.reset();
+    voted_for_ = server;
+    persist();
+
+    rpc::RequestVoteResponse message{rank_, id_, term_, true};
+    mpi_.send(server, message, MessageTag::VOTE);
+}
+
+void Group::become_leader()
+{
+    init_next_index();
+    init_commit_index();
+    status_ = Status::LEADER;
+    leader_ = rank_;
+    transfer_target_ = -1;
+    stats_.leaderships++;
+    timings_.election.record(utils::now().count() - election_start_);
+    LOG(INFO) << "become the leader";
+
+    // The election timeout now paces the quorum checks
+    std::fill(recent_contact_.begin(), recent_contact_.end(), false);
+    set_election_timeout(heartbeat_interval_);
+    timeout_.reset();
+
+    match_index_.reset();
+    membership_orders_.clear();
+
+    // Requests of the previous terms may still be retried
+    appended_ids_ = applied_ids_;
+    for (int i = log_entries_.get_commit_index() + 1;
+         i <= log_entries_.last_log_index(); i++)
+        record_id(appended_ids_, i);
+
+    arrivals_.clear();
+    replies_.clear();
+    traced_.clear();
+    traced_replies_.clear();
+
+    // Uncommited entries of the previous terms are kept, they are commited
+    // along with this empty entry once a majority has it
+    append_entries(term_, rpc::ClientRequest{rpc::no_op_client, id_,
+                                             static_cast<unsigned>(term_),
+                                             {}});
+
+    update_own_match();
+
+    for (int i = 1; i <= nb_server_; i++)
+        if (i != rank_)
+            if (auto message = heartbeat(i))
+                mpi_.send(i, *message, MessageTag::APPEND_ENTRIES);
+}
+
+void Group::start_pre_vote()
+{
+    LOG(INFO) << "Become pre-candidate";
+
+    // Failed rounds are part of the election
+    if (status_ == Status::FOLLOWER)
+        election_start_ = utils::now().count();
+
+    status_ = Status::PRE_CANDIDATE;
+    timeout_.reset();
+    stats_.pre_votes++;
+
+    // Check that an election for the next term could be won without
+    // increasing the current term, so that a server which cannot win does not
+    // disrupt the cluster
+    auto message = rpc::RequestVote{
+        id_,   term_ + 1, rank_, log_entries_.last_log_index(),
+        log_entries_.last_log_term(), false};
+
+    broadcast(message, MessageTag::PRE_VOTE);
+    reset_votes();
+
+    if (count_vote(rank_))
+        start_election();
+}
+
+void Group::start_election(bool transfer)
+{
+    LOG(INFO) << "Become candidate";
+
+    if (transfer)
+        election_start_ = utils::now().count();
+
+    status_ = Status::CANDIDATE;
+    timeout_.reset();
+    update_term();
+    voted_for_ = rank_;
+    persist();
+    stats_.elections++;
+
+    // Ask for votes
+    auto message =
+        rpc::RequestVote{id_,      term_, rank_, log_entries_.last_log_index(),
+                         log_entries_.last_log_term(), transfer};
+
+    broadcast(message, MessageTag::REQUEST_VOTE);
+    reset_votes();
+
+    if (count_vote(rank_))
+        become_leader();
+}
+
+bool Group::give_up_election(const rpc::RequestVoteResponse& recv_data)
+{
+    if (recv_data.term <= term_)
+        return false;
+
+    // Catch up with the term of the voter, so that the next pre-vote can be
+    // granted if this server has the most up to date log
+    LOG(INFO) << "got a vote from " << recv_data.source << " at higher term "
+              << recv_data.term;
+    update_term(recv_data.term);
+    status_ = Status::FOLLOWER;
+
+    return true;
+}
+
+void Group::reset_votes()
+{
+    std::fill(votes_.begin(), votes_.end(), false);
+}
+
+bool Group::count_vote(rank voter)
+{
+    votes_[voter] = true;
+
+    auto count = std::count(votes_.begin(), votes_.end(), true);
+    return membership().majority(count);
+}
+
+bool Group::leader_alive() const
+{
+    auto min_timeout = std::chrono::duration<double>(timeout_.lower_bound
+                                                     * timeout_.speed_mod);
+
+    return utils::now() - last_leader_contact_ < min_timeout;
+}
+
+bool Group::up_to_date(int index, int term) const
+{
+    if (term != log_entries_.last_log_term())
+        return term > log_entries_.last_log_term();
+    return index >= log_entries_.last_log_index();
+}
+
+//------------------------------------------------------------------//
+//                            Utilities                             //
+//------------------------------------------------------------------//
+
+void Group::set_election_timeout(double heartbeat_interval)
+{
+    auto lower_bound = std::clamp(election_heartbeat_ratio * heartbeat_interval,
+                                  election_min_, election_max_);
+
+    // Spread leadership across servers: the preferred server of a group
+    // times out earlier so that it usually wins its elections
+    if (preferred_)
+        lower_bound = std::max(lower_bound / 2, election_min_);
+
+    timeout_.lower_bound = lower_bound;
+    timeout_.upper_bound = 2 * lower_bound;
+}
+
+void Group::update_term()
+{
+    update_term(term_ + 1);
+}
+
+void Group::update_term(int term)
+{
+    if (term > term_)
+        voted_for_ = -1;
+
+    if (term >= term_)
+        term_ = term;
+
+    persist();
+
+    LOG(INFO) << "current term: " << term_;
+}
+
+void Group::persist()
+{
+    state_.save(term_, voted_for_, log_entries_.get_commit_index());
+}
+
+void Group::append_entries(int term, rpc::ClientRequest data)
+{
+    LOG(INFO) << "AppendEntries: index = " << log_entries_.size()
+              << ", term: " << term << ", client: " << data.source
+              << ", command: " << data.command << ", id " << data.id;
+
+    log_entries_.append_entry(term, data);
+
+    if (data.source == rpc::config_client)
+        apply_membership(log_entries_.last_log_index(), data.command);
+}
+
+void Group::apply_membership(int index, const rpc::command_t& command)
+{
+    auto membership = utils::Membership::decode(command);
+
+    if (!membership
+        || membership->str().size() != static_cast<std::size_t>(nb_server_))
+    {
+        LOG(ERROR) << "invalid configuration at index " << index;
+        return;
+    }
+
+    configurations_.emplace_back(index, *membership);
+    update_membership();
+}
+
+void Group::update_membership()
+{
+    LOG(INFO) << "members: " << membership().str() << ", from index "
+              << configurations_.back().first;
+
+    // Removing a voter may leave a majority which is further ahead
+    if (match_index_.set_voters(membership().voters())
+        && status_ == Status::LEADER)
+        advance_commit_index();
+}
+
+const utils::Membership& Group::membership() const
+{
+    return configurations_.back().second;
+}
+
+void Group::order_membership(rank server, utils::Membership::Role role)
+{
+    if (status_ != Status::LEADER || server < 1 || server > nb_server_)
+        return;
+
+    if (nb_server_ > utils::Membership::max_servers)
+    {
+        LOG(ERROR) << "configurations of " << nb_server_
+                   << " servers do not fit in an entry";
+        return;
+    }
+
+    LOG(INFO) << (role == utils::Membership::Role::NONE ? "removing "
+                                                        : "adding ")
+              << "server " << server;
+    membership_orders_.emplace_back(server, role);
+}
+
+void Group::broadcast(const rpc::RequestVote& message, int tag)
+{
+    // Learners and spares do not vote
+    for (auto i = 1; i <= nb_server_; i++)
+        if (i != rank_ && membership().voter(i))
+            mpi_.send(i, message, tag);
+}
+
+void Group::trace_sent(rank server, int first, int last)
+{
+    auto now = utils::now().count();
+    for (auto& traced : traced_)
+    {
+        if (traced.index > last)
+            break;
+
+        // Only the first send of a retried entry is kept
+        if (traced.index >= first && !traced.sent[server])
+            traced.sent[server] = now;
+    }
+}
+
+void Group::trace_acknowledged(rank server, int index)
+{
+    auto now = utils::now().count();
+    for (auto& traced : traced_)
+    {
+        if (traced.index > index)
+            break;
+
+        if (traced.sent[server] > 0)
+        {
+            tracer_.span("append_entries", traced.client, traced.id,
+                         traced.sent[server], now, server);
+            traced.sent[server] = -1;
+        }
+    }
+}
+
+std::vector<unsigned>
+Group::request_ids(const std::vector<rpc::ClientRequest>& requests)
+{
+    std::vector<unsigned> ids;
+    ids.reserve(requests.size());
+
+    for (const auto& request : requests)
+        ids.push_back(request.id);
+
+    return ids;
+}
+
+void Group::send_client_response(rank client,
+                                 const rpc::ClientRequestResponse& message,
+                                 const std::vector<unsigned>& ids)
+{
+    utils::Buffer buffer;
+    buffer.push(message);
+    buffer.push(ids);
+
+    mpi_.send(client, buffer.bytes(), MessageTag::CLIENT_REQUEST_RESPONSE);
+}
+
+//------------------------------------------------------------------//
+//                         Message handlers                         //
+//------------------------------------------------------------------//
+
+void Group::handle_append_entry_response(
+    const rpc::AppendEntriesResponse& recv_data)
+{
+    if (status_ != Status::LEADER || !membership().member(recv_data.source))
+        return;
+
+    LOG(INFO) << "received append_entry_response from server :"
+              << recv_data.source << ", added log: " << std::boolalpha
+              << recv_data.value;
+
+    recent_contact_[recv_data.source] = true;
+
+    if (recv_data.value)
+        trace_acknowledged(recv_data.source, recv_data.log_index);
+
+    next_index_[recv_data.source] = recv_data.log_index + 1;
+    commit_index_[recv_data.source] = recv_data.commit_index;
+
+    LOG(INFO) << "server :" << recv_data.source
+              << " next index: " << next_index_[recv_data.source]
+              << " commit index: " << commit_index_[recv_data.source];
+
+    if (recv_data.source == transfer_target_)
+        continue_transfer();
+
+    // Keep streaming sealed entries to a follower catching up
+    batch_in_flight_[recv_data.source] = false;
+    if (recv_data.value
+        && log_entries_.sealed_range(next_index_[recv_data.source], 1))
+        replicate(recv_data.source);
+
+    if (recv_data.value && match_index_.update(recv_data.source,
+                                               recv_data.log_index))
+        advance_commit_index();
+}
+
+rpc::AppendEntriesResponse
+Group::handle_append_entries(const rpc::AppendEntries& recv_data)
+{
+    rpc::AppendEntriesResponse message{rank_,
+                                       id_,
+                                       false,
+                                       log_entries_.last_log_index(),
+                                       log_entries_.get_commit_index(),
+                                       recv_data.timestamp};
+
+    if (!accept_append_entries(recv_data, message))
+        return message;
+
+    int index = recv_data.prev_log_index + 1;
+
+    // No entry, message is just a heartbeat. An entry already in the log is
+    // kept, one which conflicts with it is replaced along with what follows.
+    if (recv_data.entry
+        && (index > log_entries_.last_log_index()
+            || log_entries_.term(index) != recv_data.entry_term))
+    {
+        if (index <= log_entries_.last_log_index())
+        {
+            LOG(INFO) << "delete from index " << index;
+            truncate_log(index);
+        }
+
+        auto start = utils::now().count();
+        append_entries(recv_data.entry_term, *recv_data.entry);
+
+        if (tracer_.sampled(recv_data.entry->source, recv_data.entry->id))
+            tracer_.span("follower_append", recv_data.entry->source,
+                         recv_data.entry->id, start, utils::now().count());
+    }
+
+    // Entries past the ones the leader sent were not checked against its log,
+    // they may not be commited yet
+    int verified = recv_data.entry ? index : recv_data.prev_log_index;
+
+    update_commit_index(std::min(recv_data.leader_commit, verified));
+    update_term(recv_data.term);
+
+    // The leader counts the entries as replicated once acknowledged
+    log_entries_.wait_durable(verified);
+
+    message.value = recv_data.entry.has_value();
+    message.log_index = verified;
+    message.commit_index = log_entries_.get_commit_index();
+
+    LOG(INFO) << "accept append entries " << message.commit_index << "/"
+              << message.log_index;
+
+    return message;
+}
+
+rpc::AppendEntriesResponse
+Group::handle_append_entries_batch(const rpc::AppendEntriesBatch& recv_data,
+                                   const char* data)
+{
+    const auto& entries = recv_data.message;
+
+    rpc::AppendEntriesResponse message{rank_,
+                                       id_,
+                                       false,
+                                       log_entries_.last_log_index(),
+                                       log_entries_.get_commit_index(),
+                                       entries.timestamp};
+
+    if (!accept_append_entries(entries, message))
+        return message;
+
+    auto headers_size =
+        recv_data.nb_entries * sizeof(utils::LogEntries::Header);
+    std::vector<char> raw;
+
+    if (recv_data.compressed_size)
+    {
+        auto start = utils::now();
+
+        raw.resize(headers_size + recv_data.payload_size);
+        bool valid = utils::lz4_decompress(data, recv_data.compressed_size,
+                                           raw.data(), raw.size());
+
+        stats_.decompress_time += (utils::now() - start).count();
+
+        if (!valid)
+        {
+            LOG(ERROR) << "invalid compressed batch, rejecting it";
+            return message;
+        }
+
+        data = raw.data();
+    }
+
+    auto headers = reinterpret_cast<const utils::LogEntries::Header*>(data);
+    auto payload = data + headers_size;
+
+    // Payload offsets are relative to the segment of the leader
+    auto first_offset = headers[0].offset;
+
+    for (int i = 0; i < recv_data.nb_entries; i++)
+    {
+        // Offsets before the first one wrap around and are rejected too
+        if (std::uint64_t{headers[i].offset - first_offset} + headers[i].length
+                > recv_data.payload_size
+            || !utils::LogEntries::verify(
+                headers[i], payload + headers[i].offset - first_offset))
+        {
+            LOG(ERROR) << "corrupted entry " << entries.prev_log_index + 1 + i
+                       << ", rejecting the batch";
+            return message;
+        }
+    }
+
+    LOG(INFO) << "AppendEntries: " << recv_data.nb_entries
+              << " entries from index " << entries.prev_log_index + 1;
+
+    auto start = utils::now().count();
+
+    for (int i = 0; i < recv_data.nb_entries; i++)
+    {
+        int index = entries.prev_log_index + 1 + i;
+
+        if (index <= log_entries_.last_log_index())
+        {
+            // Commited entries are the same on every server
+            if (index <= log_entries_.get_commit_index()
+                || log_entries_.term(index) == headers[i].term)
+                continue;
+
+            truncate_log(index);
+        }
+
+        auto entry = payload + headers[i].offset - first_offset;
+        log_entries_.append_entry(headers[i], entry);
+
+        if (headers[i].client == rpc::config_client)
+            apply_membership(index, rpc::command_t(entry, headers[i].length));
+    }
+
+    // Entries of a batch are appended together, they share their span
+    if (tracer_.enabled())
+    {
+        auto end = utils::now().count();
+        for (int i = 0; i < recv_data.nb_entries; i++)
+            if (tracer_.sampled(headers[i].client, headers[i].id))
+                tracer_.span("follower_append", headers[i].client,
+                             headers[i].id, start, end);
+    }
+
+    int verified = entries.prev_log_index + recv_data.nb_entries;
+
+    update_commit_index(std::min(entries.leader_commit, verified));
+    update_term(entries.term);
+
+    log_entries_.wait_durable(verified);
+
+    message.value = true;
+    message.log_index = verified;
+    message.commit_index = log_entries_.get_commit_index();
+
+    return message;
+}
+
+void Group::handle_client_request(
+    const std::vector<rpc::ClientRequest>& recv_data)
+{
+    if (recv_data.empty())
+        return;
+
+    // No new writes during a transfer, the client is redirected to the
+    // future leader
+    if (status_ != Status::LEADER || transfer_target_ != -1)
+        return reject_client(recv_data);
+
+    if (!admit_client(recv_data))
+        return;
+
+    LOG(INFO) << "received " << recv_data.size()
+              << " commands from client:" << recv_data.front().source;
+
+    auto received = utils::now().count();
+
+    // The whole batch is appended before anything is replicated, its entries
+    // are consecutive and commit together
+    for (const auto& request : recv_data)
+    {
+        // Retries of requests already in the log are not appended, the
+        // client is answered once they are commited, or right away if they
+        // already are
+        if (known_id(appended_ids_, request.source, request.id))
+        {
+            if (known_id(applied_ids_, request.source, request.id))
+                notifications_[request.source].push_back(request.id);
+            continue;
+        }
+
+        append_entries(term_, request);
+        record_id(appended_ids_, log_entries_.last_log_index());
+
+        arrivals_.push_back(
+            Arrival{log_entries_.last_log_index(), received, false});
+
+        if (tracer_.sampled(request.source, request.id))
+            traced_.push_back(Traced{log_entries_.last_log_index(),
+                                     request.source, request.id, 0, 0, 0,
+                                     std::vector<double>(nb_server_ + 1)});
+    }
+
+    auto appended = utils::now().count();
+    timings_.append.record(appended - received);
+
+    for (auto it = traced_.rbegin();
+         it != traced_.rend() && !it->appended; it++)
+    {
+        it->appended = appended;
+        tracer_.span("append", it->client, it->id, received, appended);
+    }
+
+    update_own_match();
+}
+
+void Group::handle_request_vote(const rpc::RequestVote& recv_data)
+{
+    // A leader does not answer vote requests
+    if (status_ == Status::LEADER)
+        return;
+
+    rpc::RequestVoteResponse message{rank_, id_, term_, false};
+
+    // Ignore candidates while the leader is alive, they are most likely
+    // partitioned away and would only disrupt the cluster, unless the leader
+    // itself asked for this election
+    if (recv_data.term < term_ || (leader_alive() && !recv_data.transfer))
+    {
+        LOG(INFO) << "rejecting vote for " << recv_data.candidate;
+        return mpi_.send(recv_data.candidate, message, MessageTag::VOTE);
+    }
+
+    if (recv_data.term > term_)
+    {
+        update_term(recv_data.term);
+        status_ = Status::FOLLOWER;
+    }
+
+    if ((voted_for_ == -1 || voted_for_ == recv_data.candidate)
+        && up_to_date(recv_data.last_log_index, recv_data.last_log_term))
+        return vote(recv_data.candidate);
+
+    LOG(INFO) << "rejecting vote for " << recv_data.candidate;
+    mpi_.send(recv_data.candidate, message, MessageTag::VOTE);
+}
+
+void Group::handle_vote(const rpc::RequestVoteResponse& recv_data)
+{
+    if (status_ != Status::CANDIDATE || give_up_election(recv_data))
+        return;
+
+    // A late answer to an election of an earlier term
+    if (recv_data.term != term_)
+        return;
+
+    if (!recv_data.value)
+    {
+        LOG(INFO) << "got a reject vote from " << recv_data.source;
+        return;
+    }
+
+    // Only the voters of the configuration of this candidate count
+    if (!membership().voter(recv_data.source))
+        return;
+
+    LOG(INFO) << "got a vote from " << recv_data.source;
+
+    // If got a majority of votes, become the leader
+    if (count_vote(recv_data.source))
+        become_leader();
+}
+
+void Group::handle_pre_vote(const rpc::RequestVote& recv_data)
+{
+    // Pre-votes change neither the term nor the election timeout
+    bool value = status_ != Status::LEADER && !leader_alive()
+        && recv_data.term > term_
+        && up_to_date(recv_data.last_log_index, recv_data.last_log_term);
+
+    LOG(INFO) << (value ? "granting" : "rejecting") << " pre-vote for "
+              << recv_data.candidate;
+
+    // A grant is for the term it was asked for, a reject tells the term of
+    // this server
+    rpc::RequestVoteResponse message{rank_, id_,
+                                     value ? recv_data.term : term_, value};
+    mpi_.send(recv_data.candidate, message, MessageTag::PRE_VOTE_RESPONSE);
+}
+
+void Group::handle_pre_vote_response(const rpc::RequestVoteResponse& recv_data)
+{
+    if (status_ != Status::PRE_CANDIDATE)
+        return;
+
+    if (!recv_data.value)
+    {
+        give_up_election(recv_data);
+        return;
+    }
+
+    // Granted for the term of an earlier election
+    if (recv_data.term != term_ + 1 || !membership().voter(recv_data.source))
+        return;
+
+    LOG(INFO) << "got a pre-vote from " << recv_data.source;
+
+    // The election can be won, start it for real
+    if (count_vote(recv_data.source))
+        start_election();
+}
+
+void Group::handle_timeout_now(const rpc::TimeoutNow& recv_data)
+{
+    if (recv_data.term != term_ || status_ == Status::LEADER)
+        return;
+
+    LOG(INFO) << "leadership transferred by " << recv_data.source;
+
+    // The leader made sure this server is up to date, skip the pre-vote
+    start_election(true);
+}
+
+//------------------------------------------------------------------//
+//                            Repl orders                           //
+//------------------------------------------------------------------//
+
+void Group::print(std::ostream& ostr)
+{
+    ostr << " Group: " << id_ << "\n";
+    ostr << "Leader: " << leader_ << "\n";
+    ostr << "Member: " << membership().str() << "\n";
+
+    if (status_ == Status::LEADER)
+    {
+        next_index_[rank_] = log_entries_.size();
+        commit_index_[rank_] = log_entries_.get_commit_index();
+        ostr << "NxtIdx: ";
+        for (int i = 1; i <= nb_server_; i++)
+            ostr << next_index_[i] << " ";
+        ostr << "\n";
+
+        ostr << "Commit: ";
+        for (int i = 1; i <= nb_server_; i++)
+            ostr << commit_index_[i] << " ";
+        ostr << "\n";
+    }
+
+    ostr << "  Term: " << term_ << "\n";
+    ostr << "Elects: " << stats_.elections << "\n";
+    ostr << "ElecTO: " << timeout_.lower_bound * 1000 << "-"
+         << timeout_.upper_bound * 1000 << " ms\n";
+    ostr << "NbLogs: " << log_entries_.get_commit_index() + 1 << "/"
+         << log_entries_.size() << "\n";
+    ostr << "Admits: " << stats_.admitted << ", " << stats_.throttled
+         << " throttled\n";
+
+    std::size_t heap = 0;
+    std::size_t mapped = 0;
+    auto segments = log_entries_.memory();
+    for (const auto& segment : segments)
+    {
+        if (segment.sealed)
+            mapped += segment.header_bytes + segment.payload_bytes;
+        heap += segment.capacity_bytes;
+    }
+    ostr << "LogMem: " << heap / 1024 << " KiB heap, " << mapped / 1024
+         << " KiB mapped in " << segments.size() << " segments\n";
+}
+
+rpc::GroupMetrics Group::metrics() const
+{
+    int max_lag = 0;
+
+    if (status_ == Status::LEADER)
+        for (int i = 1; i <= nb_server_; i++)
+            if (i != rank_ && membership().member(i))
+                max_lag = std::max(max_lag,
+                                   log_entries_.last_log_index() + 1
+                                       - next_index_[i]);
+
+    return rpc::GroupMetrics{id_,
+                             term_,
+                             status_ == Status::LEADER,
+                             log_entries_.last_log_index(),
+                             log_entries_.get_commit_index(),
+                             max_lag,
+                             stats_.throttled,
+                             timings_.commit.percentile(50),
+                             timings_.commit.percentile(99)};
+}
+
+void Group::set_speed(int speed_mod)
+{
+    timeout_.speed_mod = speed_mod;
+}
+
+void Group::transfer_leadership(rank server)
+{
+    if (status_ != Status::LEADER || server == rank_ || server < 1
+        || server > nb_server_ || !membership().voter(server))
+        return;
+
+    LOG(INFO) << "start leadership transfer to " << server;
+
+    transfer_target_ = server;
+
+    // Give the transfer an election timeout to complete
+    timeout_.reset();
+    continue_transfer();
+}
+
+void Group::add_server(rank server)
+{
+    order_membership(server, utils::Membership::Role::LEARNER);
+}
+
+void Group::remove_server(rank server)
+{
+    order_membership(server, utils::Membership::Role::NONE);
+}
+
+void Group::recover()
+{
+    status_ = Status::FOLLOWER;
+
+    // Crashed leaders do not answer
+    for (auto& [client, ids] : notifications_)
+        ids.clear();
+
+    // Whatever was only in memory is lost, uncommited entries on disk are
+    // kept: the leader only sends the ones missing or conflicting with its log
+    auto state = state_.load();
+    term_ = state ? state->term : 0;
+    voted_for_ = state ? state->voted_for : -1;
+    log_entries_.reload(state ? state->commit_index : -1);
+
+    // Configurations and the requests applied are read back from the log,
+    // the last configuration is in use
+    configurations_.erase(configurations_.begin() + 1, configurations_.end());
+    applied_ids_.clear();
+
+    for (int i = log_entries_.first_log_index();
+         i <= log_entries_.last_log_index(); i++)
+    {
+        if (log_entries_.header(i).client == rpc::config_client)
+            apply_membership(i, log_entries_[i].data.command);
+
+        if (i <= log_entries_.get_commit_index())
+            record_id(applied_ids_, i);
+    }
+    update_membership();
+
+    LOG(INFO) << "recovered at term " << term_ << " with "
+              << log_entries_.last_log_index() + 1 << " entries, "
+              << log_entries_.get_commit_index() + 1 << " commited";
+
+    timeout_.reset();
+}
@@ -0,0 +1,369 @@
+#pragma once
+
+#include <deque>
+#include <optional>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+
+#include "common.hh"
+#include "config.hh"
+#include "mpi/mpi.hh"
+#include "rpc/rpc.hh"
+#include "utils/durable_state.hh"
+#include "utils/histogram.hh"
+#include "utils/log_entries.hh"
+#include "utils/logger.hh"
+#include "utils/membership.hh"
+#include "utils/quorum.hh"
+#include "utils/time.hh"
+#include "utils/trace.hh"
+
+/// A single RAFT consensus group. A server hosts several of them, each with its
+/// own log, term and election state, sharing the server transport and timers.
+class Group
+{
+public:
+    enum class Status
+    {
+        FOLLOWER,
+        PRE_CANDIDATE,
+        CANDIDATE,
+        LEADER,
+    };
+
+    /// Election counters, to measure how disruptive elections are,
+    /// compression counters of the batches sent and received, and admission
+    /// decisions on client requests
+    struct Stats
+    {
+        std::size_t pre_votes = 0;
+        std::size_t elections = 0;
+        std::size_t leaderships = 0;
+        std::size_t step_downs = 0;
+        std::size_t transfers = 0;
+
+        std::size_t compressed_batches = 0;
+        std::size_t raw_bytes = 0;
+        std::size_t compressed_bytes = 0;
+        double compress_time = 0;
+        double decompress_time = 0;
+
+        std::size_t admitted = 0;
+        std::size_t throttled = 0;
+        int max_uncommitted = 0;
+        std::size_t max_uncommitted_bytes = 0;
+    };
+
+    /// Time spent by client requests from their reception by the leader to
+    /// their append to its log, their replication on a majority, their
+    /// commit and the response to their client, and time from the start of
+    /// an election this server wins to its leadership
+    struct Timings
+    {
+        utils::Histogram append;
+        utils::Histogram quorum;
+        utils::Histogram commit;
+        utils::Histogram reply;
+        utils::Histogram election;
+    };
+
+    Group(int id, rank rank, const Config& config, mpi::Mpi& mpi,
+          utils::Logger& logger, utils::Tracer& tracer);
+
+    /// Main functions
+    /// \{
+    /// If the election timeout is reached then start a pre-vote, or check that
+    /// the majority is still reachable when leading. Voters only, learners and
+    /// spares never start elections.
+    void update();
+
+    /// Heartbeat for `server`, empty heartbeats are returned so that the
+    /// server can coalesce them with the ones of other groups, otherwise the
+    /// next entry is sent right away
+    std::optional<rpc::AppendEntries> heartbeat(rank server);
+
+    /// Heartbeat valid for every up to date follower, relayed by followers
+    /// when heartbeats are fanned out
+    rpc::AppendEntries relayed_heartbeat();
+
+    /// Notify every client of its requests commited since the last call, in
+    /// a single message per client
+    void flush_notifications();
+
+    /// Send the next entry to `server` if it lags behind, or a batch of
+    /// entries when they are in a sealed segment, return whether entries
+    /// were sent
+    bool replicate(rank server);
+
+    bool is_leader() const;
+
+    const Stats& stats() const;
+    const Timings& timings() const;
+
+    /// Memory used by each segment of the log
+    std::vector<utils::LogEntries::SegmentStats> memory() const;
+
+    /// Heartbeat interval of the server, the election timeout of the groups it
+    /// leads and of their followers is derived from it
+    void set_heartbeat_interval(double interval);
+    /// \}
+
+    /// Handlers
+    /// \{
+    void
+    handle_append_entry_response(const rpc::AppendEntriesResponse& recv_data);
+    rpc::AppendEntriesResponse
+    handle_append_entries(const rpc::AppendEntries& recv_data);
+    rpc::AppendEntriesResponse
+    handle_append_entries_batch(const rpc::AppendEntriesBatch& recv_data,
+                                const char* data);
+    /// Commands of a client, all routed to this group
+    void
+    handle_client_request(const std::vector<rpc::ClientRequest>& recv_data);
+    void handle_request_vote(const rpc::RequestVote& recv_data);
+    void handle_vote(const rpc::RequestVoteResponse& recv_data);
+    void handle_pre_vote(const rpc::RequestVote& recv_data);
+    void handle_pre_vote_response(const rpc::RequestVoteResponse& recv_data);
+    void handle_timeout_now(const rpc::TimeoutNow& recv_data);
+    /// \}
+
+    /// Repl orders
+    /// \{
+    void print(std::ostream& ostr);
+    rpc::GroupMetrics metrics() const;
+    void set_speed(int speed_mod);
+    /// Restart from the term, vote and log left on disk by the crash
+    void recover();
+    /// Hand the leadership over to `server` once it is up to date
+    void transfer_leadership(rank server);
+    /// Add `server` as a learner, promoted to voter once it caught up, or
+    /// remove it, one server at a time. Only the leader acts on them.
+    void add_server(rank server);
+    void remove_server(rank server);
+    /// \}
+
+private:
+    /// Leader
+    /// \{
+    // Empty AppendEntries for a server whose next entry is `next_index`
+    rpc::AppendEntries heartbeat_message(int next_index);
+    void init_next_index();
+    void init_commit_index();
+    // Step down if the majority was not heard of since the last check
+    void check_quorum();
+    // Bring the transfer target up to date, then tell it to start an election
+    void continue_transfer();
+    // Commit up to the index replicated on a majority
+    void advance_commit_index();
+    // Count the entries of the leader once they are on its disk, as for
+    // any other server
+    void update_own_match();
+    // Append the next membership change once the previous one is commited:
+    // promote a learner which caught up, or apply a queued order
+    void change_membership();
+    // Append the entry of a configuration and apply it right away
+    void propose_membership(const utils::Membership& membership);
+    // Add entry to commit log, its client is notified on the next flush
+    void commit_entry(int log_index, const rpc::ClientRequest& request);
+    // Whether the request `id` of `client` is in `ids`
+    static bool known_id(const std::unordered_map<rank, unsigned>& ids,
+                         rank client, unsigned id);
+    // Record the request of entry `index` in `ids`
+    void record_id(std::unordered_map<rank, unsigned>& ids, int index);
+    // Stream entries of a sealed segment to `server`
+    void send_batch(rank server, const utils::LogEntries::Range& range);
+    // Whether appending the commands of `recv_data` keeps the uncommited
+    // entries within the limits, the client is asked to retry later otherwise
+    bool admit_client(const std::vector<rpc::ClientRequest>& recv_data);
+    /// \}
+
+    /// Follower
+    /// \{
+    void reject_client(const std::vector<rpc::ClientRequest>& recv_data);
+    void update_commit_index(int index);
+    // Delete the entries from `index`, and the configurations they set
+    void truncate_log(int index);
+    // Whether entries following `recv_data.prev_log_index` can be appended,
+    // the response is filled in case of rejection
+    bool accept_append_entries(const rpc::AppendEntries& recv_data,
+                               rpc::AppendEntriesResponse& message);
+    /// \}
+
+    /// Elections
+    /// \{
+    void vote(int server);
+    void become_leader();
+    void start_pre_vote();
+    void start_election(bool transfer = false);
+    // Step down if the voter is at a higher term
+    bool give_up_election(const rpc::RequestVoteResponse& recv_data);
+    // Start a round with the vote of this server only
+    void reset_votes();
+    // Count the vote of `voter` once, return whether a majority voted
+    bool count_vote(rank voter);
+    // Whether a leader was heard of during the last election timeout
+    bool leader_alive() const;
+    // Whether a log ending at `index` and `term` is at least as up to date
+    bool up_to_date(int index, int term) const;
+    /// \}
+
+    /// Utilities
+    /// \{
+    void set_election_timeout(double heartbeat_interval);
+    void update_term();
+    void update_term(int term);
+    /// Write the term, the vote and the commit index to disk, before any
+    /// message depending on them is sent
+    void persist();
+    void append_entries(int term, rpc::ClientRequest data);
+    /// Apply the configuration of entry `index`, as soon as it is appended
+    void apply_membership(int index, const rpc::command_t& command);
+    /// Use the last configuration of the log
+    void update_membership();
+    const utils::Membership& membership() const;
+    /// Queue a membership order, if leading
+    void order_membership(rank server, utils::Membership::Role role);
+    static std::vector<unsigned>
+    request_ids(const std::vector<rpc::ClientRequest>& requests);
+    void send_client_response(rank client,
+                              const rpc::ClientRequestResponse& message,
+                              const std::vector<unsigned>& ids = {});
+    void broadcast(const rpc::RequestVote& message, int tag);
+    /// Record when sampled entries from `first` to `last` are sent to
+    /// `server`, and trace their replication once it acknowledges `index`
+    void trace_sent(rank server, int first, int last);
+    void trace_acknowledged(rank server, int index);
+    /// \}
+
+private:
+    /// Identifier of the group
+    int id_;
+
+    /// Status of the server in this group
+    Status status_;
+
+    /// Rank of the server
+    rank rank_;
+
+    /// Size of the network
+    int nb_server_;
+
+    /// Rank of the leader
+    rank leader_;
+
+    /// Timestamp of the timeout
+    utils::Timeout timeout_;
+
+    /// Limits of the election timeout lower bound
+    double election_min_;
+    double election_max_;
+
+    /// Whether this server is the preferred leader of the group
+    bool preferred_;
+
+    /// Heartbeat interval advertised to followers
+    double heartbeat_interval_;
+
+    /// Current term
+    int term_;
+
+    /// Candidate voted for in current term, -1 if none
+    rank voted_for_;
+
+    /// Voters which granted their vote in the current round, indexed by rank,
+    /// so that a duplicated response is counted once
+    std::vector<bool> votes_;
+
+    /// Last time an AppendEntries from the leader was accepted
+    utils::timestamp last_leader_contact_;
+
+    /// Servers which answered since the last quorum check
+    std::vector<bool> recent_contact_;
+
+    /// Server the leadership is being transferred to, -1 if none
+    rank transfer_target_;
+
+    Stats stats_;
+    Timings timings_;
+
+    /// Entry appended by this leader and not commited yet, with the time its
+    /// request was received
+    struct Arrival
+    {
+        int index;
+        double received;
+        bool quorum;
+    };
+    std::deque<Arrival> arrivals_;
+
+    /// Reception time of the requests commited since the last flush
+    std::vector<double> replies_;
+
+    /// Sampled entry appended by this leader, with the times of its steps
+    /// and the first time it was sent to each server, -1 once acknowledged
+    struct Traced
+    {
+        int index;
+        rank client;
+        unsigned id;
+        double appended;
+        double quorum;
+        double committed;
+        std::vector<double> sent;
+    };
+    std::deque<Traced> traced_;
+
+    /// Sampled entries commited since the last flush
+    std::vector<Traced> traced_replies_;
+
+    /// Start of the last election of this server
+    double election_start_;
+
+    /// index of the next log entry to send to that server
+    std::vector<int> next_index_;
+
+    /// commit index on each server
+    std::vector<int> commit_index_;
+
+    /// Whether a batch sent to that server was not acknowledged yet
+    std::vector<bool> batch_in_flight_;
+
+    /// Size from which batches are compressed, 0 to never compress them
+    std::size_t compress_min_;
+
+    /// Ids of the requests commited since the last flush, per client
+    std::unordered_map<rank, std::vector<unsigned>> notifications_;
+
+    /// Highest id of the commited requests of each client, and of the ones
+    /// in the log when leader. Clients number their requests in order, a
+    /// retried request is not appended again.
+    std::unordered_map<rank, unsigned> applied_ids_;
+    std::unordered_map<rank, unsigned> appended_ids_;
+
+    /// Limits of the uncommited entries and bytes, 0 for no limit
+    int max_uncommitted_;
+    std::size_t max_uncommitted_bytes_;
+
+    /// Log entries
+    utils::LogEntries log_entries_;
+
+    /// Term, vote and commit index on disk
+    utils::DurableState state_;
+
+    /// Index of the log matched by each server, when leader
+    utils::QuorumIndex match_index_;
+
+    /// Configurations set by the entries of the log with their index, the
+    /// first one is the initial configuration at index -1. The last one is
+    /// in use, even before it is commited.
+    std::vector<std::pair<int, utils::Membership>> configurations_;
+
+    /// Membership orders waiting for the previous change to be commited,
+    /// when leader
+    std::deque<std::pair<rank, utils::Membership::Role>> membership_orders_;
+
+    utils::Logger& logger_;
+    utils::Tracer& tracer_;
+    mpi::Mpi& mpi_;
+};
@@ -1,13 +1,18 @@
+#include <fstream>
 #include <iostream>
 #include <mpi.h>
+#include <numeric>
+#include <unistd.h>
 
 #include "client.hh"
+#include "config.hh"
 #include "repl.hh"
 #include "server.hh"
+#include "utils/trace.hh"
 
-void server(rank rank, int nb_server)
+void server(rank rank, const Config& config, utils::Tracer& tracer)
 {
-    Server server(rank, nb_server);
+    Server server(rank, config, tracer);
 
     while (!server.complete())
         server.update();
@@ -17,10 +22,13 @@ void server(rank rank, int nb_server)
 #endif
 }
 
-void client(rank rank, int nb_server)
+void client(rank rank, const Config& config, utils::Tracer& tracer)
 {
-    auto cmd_file = ".commands_" + std::to_string(rank) + ".txt";
-    Client client(rank, nb_server, cmd_file);
+    // Binary workloads are faster to parse, they take precedence
+    auto cmd_file = ".commands_" + std::to_string(rank) + ".bin";
+    if (access(cmd_file.c_str(), R_OK))
+        cmd_file = ".commands_" + std::to_string(rank) + ".txt";
+    Client client(rank, config, cmd_file, tracer);
 
     while (!client.done())
     {
@@ -38,6 +46,41 @@ void repl(int nb_server, int nb_client)
     repl();
 }
 
+/// Gather the traces of every process on the REPL, which writes them to
+/// `path`, must be called by every process
+void merge_traces(const utils::Tracer& tracer, int rank, int size,
+                  const std::string& path)
+{
+    // Times are relative to the first event of the whole system
+    double origin = tracer.origin();
+    MPI_Allreduce(MPI_IN_PLACE, &origin, 1, MPI_DOUBLE, MPI_MIN,
+                  MPI_COMM_WORLD);
+
+    auto events = tracer.to_json(origin);
+    int length = events.size();
+
+    std::vector<int> lengths(size);
+    MPI_Gather(&length, 1, MPI_INT, lengths.data(), 1, MPI_INT, 0,
+               MPI_COMM_WORLD);
+
+    std::vector<int> offsets(size);
+    std::exclusive_scan(lengths.begin(), lengths.end(), offsets.begin(), 0);
+
+    std::string all(rank ? 0 : offsets.back() + lengths.back(), '\0');
+    MPI_Gatherv(events.data(), length, MPI_CHAR, all.data(), lengths.data(),
+                offsets.data(), MPI_CHAR, 0, MPI_COMM_WORLD);
+
+    if (rank)
+        return;
+
+    std::ofstream file(path);
+    file << "{\"traceEvents\":[";
+    for (int i = 0; i < size; i++)
+        file << (i ? "," : "")
+             << std::string_view(all).substr(offsets[i], lengths[i]);
+    file << "],\"displayTimeUnit\":\"ms\"}\n";
+}
+
 bool is_client(int rank, int nb_server)
 {
     return rank > nb_server;
@@ -61,32 +104,43 @@ int main(int argc, char* argv[])
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
 
-    // TODO: add a real argument parser ?
-    if (argc != 3)
+    auto config = Config::parse(argc, argv);
+
+    if (!config)
     {
         if (!rank)
-            std::cout << "usage: " << argv[0] << " nb_server nb_client\n";
+            std::cout << Config::usage(argv[0]);
+        MPI_Finalize();
         return 1;
     }
 
-    int nb_server = std::stoi(argv[1]);
-    int nb_client = std::stoi(argv[2]);
+    int nb_server = config->nb_server;
+    int nb_client = config->nb_client;
 
     if (!rank)
     {
         std::cout << "nb_server: " << nb_server << " nb_client: " << nb_client
-                  << "\n";
+                  << " nb_group: " << config->nb_group << "\n";
     }
 
+    std::string name = is_client(rank, nb_server) ? "client"
+        : is_server(rank, nb_server)                ? "server"
+                                                    : "repl";
+    utils::Tracer tracer(rank, config->trace,
+                         name + " " + std::to_string(rank));
+
     if (is_client(rank, nb_server))
-        client(rank, nb_server);
+        client(rank, *config, tracer);
 
     else if (is_server(rank, nb_server))
-        server(rank, nb_server);
+        server(rank, *config, tracer);
 
     else if (is_repl(rank))
         repl(nb_server, nb_client);
 
+    if (tracer.enabled())
+        merge_traces(tracer, rank, size, "trace.json");
+
     MPI_Finalize();
 
     return 0;
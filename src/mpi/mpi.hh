@@ -1,40 +1,197 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <cmath>
 #include <cstring>
+#include <deque>
 #include <iostream>
 #include <map>
+#include <memory>
 #include <mpi.h>
 #include <optional>
+#include <random>
 #include <string>
+#include <vector>
 
 #include "common.hh"
 #include "rpc/rpc.hh"
+#include "utils/crc32c.hh"
+#include "utils/time.hh"
 
 namespace mpi
 {
+    /// Every message is followed by the CRC32C of its content, messages
+    /// which do not match it are dropped when received.
+    ///
+    /// Faults of the network are injected on the receiving side, per link:
+    /// a received message can be lost, or held back until its delivery time
+    /// before being queued. REPL and METRICS messages are never faulted, so
+    /// that the cluster can always be healed.
     class Mpi
     {
     public:
         using status = MPI_Status;
+        using checksum_type = std::uint32_t;
 
         using msg_stats_map_type = std::map<int, std::size_t>;
         using stats_pair_type =
             std::pair<const msg_stats_map_type&, const msg_stats_map_type&>;
 
-        Mpi() = default;
+        /// Depth of the queue of a channel, sampled each time it is polled
+        struct queue_stats_type
+        {
+            std::size_t max = 0;
+            std::size_t total = 0;
+            std::size_t samples = 0;
+        };
+
+        /// Duplicate the world communicator once per channel, every process
+        /// must construct exactly one instance
+        Mpi();
+        /// Wait for the sends in progress, every process must destroy its
+        /// instance at shutdown
+        ~Mpi();
+
+        Mpi(const Mpi&) = delete;
+        Mpi& operator=(const Mpi&) = delete;
 
         template <typename M>
         void send(rank dst, const M& message, int tag);
 
+        /// Send several messages of the same type as a single one, without
+        /// waiting for it to be received
+        template <typename M>
+        void send(rank dst, const std::vector<M>& messages, int tag);
+
+        /// Send several memory ranges as a single message without copying
+        /// them, they must stay valid until the send completes, which
+        /// `owner` is kept until. `head` is copied and sent first.
+        void send_ranges(rank dst, std::vector<char> head,
+                         const std::vector<std::pair<const void*, std::size_t>>&
+                             ranges,
+                         int tag, std::shared_ptr<const void> owner = nullptr);
+
         template <typename M>
         M recv(int src = MPI_ANY_SOURCE, int tag = MPI_ANY_TAG);
 
+        /// Receive a message sent as a vector, its size is probed first
+        template <typename M>
+        std::vector<M> recv_vector(int src = MPI_ANY_SOURCE,
+                                   int tag = MPI_ANY_TAG);
+
+        /// Receive and drop the message described by `status` whatever its
+        /// size
+        void discard(const status& status);
+
+        /// Oldest received message matching `src` and `tag`, control messages
+        /// first
         std::optional<status> available_message(int src = MPI_ANY_SOURCE,
                                                 int tag = MPI_ANY_TAG);
 
         stats_pair_type get_stats() const;
 
+        /// Number of messages received but not handled yet on `channel`
+        std::size_t queue_depth(Channel channel) const;
+
+        const queue_stats_type& get_queue_stats(Channel channel) const;
+
+        /// Number of messages dropped because of a wrong checksum
+        std::size_t corrupted_messages() const;
+
+        /// Inject `faults` on the messages received from `src`, from every
+        /// process if MPI_ANY_SOURCE. They replace the previous ones, messages
+        /// already held back keep their delivery time.
+        void set_link(int src, const rpc::LinkFaults& faults);
+
+        /// Lose every message received from `src`, from every process if
+        /// MPI_ANY_SOURCE, until healed
+        void set_partitioned(int src, bool partitioned);
+
+        /// Number of messages lost to injected faults
+        std::size_t dropped_messages() const;
+
+        /// Number of messages held back by injected faults
+        std::size_t delayed_messages() const;
+
     private:
+        /// A message moved out of MPI buffers and waiting to be handled
+        struct packet
+        {
+            MPI_Status status;
+            std::vector<char> bytes;
+        };
+
+        using queue_type = std::deque<packet>;
+
+        /// Faults of the messages received from one process
+        struct link_type
+        {
+            rpc::LinkFaults faults{};
+            bool partitioned = false;
+            /// Time the link is done receiving the previous messages, with a
+            /// capped bandwidth
+            double busy_until = 0;
+            /// Delivery time of the last message of each channel which was
+            /// not reordered, later ones are not delivered before it
+            std::array<double, NB_CHANNEL> last_delivery{};
+        };
+
+        /// Whether a message must go through the faults of its link
+        bool faulty(const status& status) const;
+
+        /// Time `packet` received at `now` is delivered at, nullopt if lost
+        std::optional<double> delivery(Channel channel, const packet& packet,
+                                       double now);
+
+        /// Hold back a copy of `message`, delivered at `time`, if its link
+        /// duplicates it
+        void duplicate(const std::pair<Channel, packet>& message, double time);
+
+        /// Delay drawn from the latency distribution of `faults`, in seconds
+        double draw_latency(const rpc::LinkFaults& faults);
+
+        MPI_Comm communicator(int tag) const;
+
+        /// Move every pending message of each channel to its queue
+        void poll();
+
+        /// Release the sends of vectors and ranges which completed
+        void complete_sends();
+
+        /// Check and remove the checksum at the end of `bytes`
+        static bool verify(std::vector<char>& bytes);
+
+        /// Find the oldest queued message matching `src` and `tag`, polling
+        /// until one arrives if `wait` is set
+        std::optional<std::pair<Channel, queue_type::iterator>>
+        find(int src, int tag, bool wait);
+
+        /// Remove the message pointed to by `it` and return its content
+        std::vector<char> take(Channel channel, queue_type::iterator it);
+
+        std::array<MPI_Comm, NB_CHANNEL> communicators_;
+        std::array<queue_type, NB_CHANNEL> queues_;
+        std::array<queue_stats_type, NB_CHANNEL> queue_stats_;
+
+        /// Sends in progress, with the buffer and the ranges they own
+        struct PendingSend
+        {
+            MPI_Request request;
+            std::vector<char> head;
+            std::shared_ptr<const void> owner;
+        };
+        std::deque<PendingSend> pending_sends_;
+
+        std::size_t corrupted_messages_;
+
+        /// Indexed by source rank
+        std::vector<link_type> links_;
+        /// Messages held back, by delivery time then arrival
+        std::multimap<double, std::pair<Channel, packet>> delayed_;
+        std::size_t dropped_messages_;
+        std::mt19937 random_;
+
         msg_stats_map_type send_stats_;
         msg_stats_map_type recv_stats_;
     };
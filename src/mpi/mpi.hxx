@@ -4,48 +4,437 @@
 
 namespace mpi
 {
+    inline Mpi::Mpi()
+        : communicators_()
+        , queues_()
+        , queue_stats_()
+        , pending_sends_()
+        , corrupted_messages_(0)
+        , links_()
+        , delayed_()
+        , dropped_messages_(0)
+        , random_(std::random_device{}())
+        , send_stats_()
+        , recv_stats_()
+    {
+        for (auto& communicator : communicators_)
+            MPI_Comm_dup(MPI_COMM_WORLD, &communicator);
+
+        int size;
+        MPI_Comm_size(MPI_COMM_WORLD, &size);
+        links_.resize(size);
+    }
+
+    inline Mpi::~Mpi()
+    {
+        // Sends in progress cannot be cancelled, every process keeps
+        // receiving and dropping messages until the sends of all of them
+        // completed, which the barrier tells once each one entered it
+        MPI_Request barrier = MPI_REQUEST_NULL;
+        int done = 0;
+
+        while (!done)
+        {
+            poll();
+            for (auto& queue : queues_)
+                queue.clear();
+            delayed_.clear();
+
+            if (barrier != MPI_REQUEST_NULL)
+                MPI_Test(&barrier, &done, MPI_STATUS_IGNORE);
+            else if (pending_sends_.empty())
+                MPI_Ibarrier(communicators_.front(), &barrier);
+        }
+
+        for (auto& communicator : communicators_)
+            MPI_Comm_free(&communicator);
+    }
+
     template <typename M>
     inline void Mpi::send(rank dst, const M& message, int tag)
     {
         // Convert the message to a char* buffer to send it the same way no
-        // matter the type of Message
-        const char* buffer = reinterpret_cast<const char*>(&message);
+        // matter the type of Message, followed by its checksum
+        char buffer[sizeof(M) + sizeof(checksum_type)];
+        std::memcpy(buffer, static_cast<const void*>(&message), sizeof(M));
 
-        MPI_Bsend(buffer, sizeof(M), MPI_CHAR, dst, tag, MPI_COMM_WORLD);
+        auto checksum = utils::crc32c(buffer, sizeof(M));
+        std::memcpy(buffer + sizeof(M), &checksum, sizeof(checksum));
+
+        MPI_Bsend(buffer, sizeof(buffer), MPI_CHAR, dst, tag,
+                  communicator(tag));
         send_stats_[tag]++;
     }
 
     template <typename M>
-    inline M Mpi::recv(int src, int tag)
+    inline void Mpi::send(rank dst, const std::vector<M>& messages, int tag)
     {
-        char buffer[sizeof(M)];
-        status status;
+        auto size = messages.size() * sizeof(M);
 
-        MPI_Recv(buffer, sizeof(M), MPI_CHAR, src, tag, MPI_COMM_WORLD,
-                 &status);
+        std::vector<char> buffer(size + sizeof(checksum_type));
+        std::memcpy(buffer.data(), static_cast<const void*>(messages.data()),
+                    size);
+
+        auto checksum = utils::crc32c(buffer.data(), size);
+        std::memcpy(buffer.data() + size, &checksum, sizeof(checksum));
+
+        // Too large to be buffered by MPI, the send owns its buffer until it
+        // completes
+        auto& send = pending_sends_.emplace_back(
+            PendingSend{MPI_REQUEST_NULL, std::move(buffer), nullptr});
+        MPI_Isend(send.head.data(), send.head.size(), MPI_CHAR, dst, tag,
+                  communicator(tag), &send.request);
+        send_stats_[tag]++;
+    }
 
-        // Convert the char* buffer back to Message type and add source and
-        // tag info
-        M message = *reinterpret_cast<M*>(buffer);
+    inline void Mpi::send_ranges(
+        rank dst, std::vector<char> head,
+        const std::vector<std::pair<const void*, std::size_t>>& ranges, int tag,
+        std::shared_ptr<const void> owner)
+    {
+        auto head_size = head.size();
+        auto checksum = utils::crc32c(head.data(), head_size);
+
+        std::vector<int> lengths{static_cast<int>(head_size)};
+        std::vector<MPI_Aint> addresses(1);
+
+        for (const auto& [data, size] : ranges)
+        {
+            checksum = utils::crc32c(data, size, checksum);
+
+            lengths.push_back(size);
+            addresses.emplace_back();
+            MPI_Get_address(data, &addresses.back());
+        }
+
+        // The checksum is owned along with the head and sent last
+        head.resize(head_size + sizeof(checksum));
+        std::memcpy(head.data() + head_size, &checksum, sizeof(checksum));
+
+        MPI_Get_address(head.data(), &addresses.front());
+        lengths.push_back(sizeof(checksum));
+        addresses.emplace_back();
+        MPI_Get_address(head.data() + head_size, &addresses.back());
+
+        // Absolute addresses, the message is sent from MPI_BOTTOM
+        MPI_Datatype type;
+        MPI_Type_create_hindexed(lengths.size(), lengths.data(),
+                                 addresses.data(), MPI_CHAR, &type);
+        MPI_Type_commit(&type);
+
+        // Moving the vector keeps its buffer, so the address stays valid
+        pending_sends_.push_back(
+            {MPI_REQUEST_NULL, std::move(head), std::move(owner)});
+        MPI_Isend(MPI_BOTTOM, 1, type, dst, tag, communicator(tag),
+                  &pending_sends_.back().request);
+
+        // Only freed once the send completes
+        MPI_Type_free(&type);
+        send_stats_[tag]++;
+    }
+
+    template <typename M>
+    inline M Mpi::recv(int src, int tag)
+    {
+        auto [channel, it] = *find(src, tag, true);
+        auto recv_tag = it->status.MPI_TAG;
+        auto buffer = take(channel, it);
 
-        recv_stats_[tag]++;
+        // Convert the char* buffer back to Message type
+        M message;
+        std::memcpy(static_cast<void*>(&message), buffer.data(),
+                    std::min(buffer.size(), sizeof(M)));
+
+        recv_stats_[recv_tag]++;
 
         return message;
     }
 
+    template <typename M>
+    inline std::vector<M> Mpi::recv_vector(int src, int tag)
+    {
+        auto [channel, it] = *find(src, tag, true);
+        auto recv_tag = it->status.MPI_TAG;
+        auto buffer = take(channel, it);
+
+        std::vector<M> messages(buffer.size() / sizeof(M));
+        std::memcpy(static_cast<void*>(messages.data()), buffer.data(),
+                    messages.size() * sizeof(M));
+
+        recv_stats_[recv_tag]++;
+
+        return messages;
+    }
+
+    inline void Mpi::discard(const status& status)
+    {
+        auto [channel, it] = *find(status.MPI_SOURCE, status.MPI_TAG, true);
+        take(channel, it);
+
+        recv_stats_[status.MPI_TAG]++;
+    }
+
     inline std::optional<Mpi::status> Mpi::available_message(int src, int tag)
     {
-        int flag;
-        status status;
-        MPI_Iprobe(src, tag, MPI_COMM_WORLD, &flag, &status);
+        auto message = find(src, tag, false);
 
-        if (!flag)
+        if (!message)
             return {};
-        return {status};
+        return {message->second->status};
     }
 
     inline Mpi::stats_pair_type Mpi::get_stats() const
     {
         return {send_stats_, recv_stats_};
     }
+
+    inline std::size_t Mpi::queue_depth(Channel channel) const
+    {
+        return queues_[channel].size();
+    }
+
+    inline const Mpi::queue_stats_type&
+    Mpi::get_queue_stats(Channel channel) const
+    {
+        return queue_stats_[channel];
+    }
+
+    inline MPI_Comm Mpi::communicator(int tag) const
+    {
+        return communicators_[tag_channel(tag)];
+    }
+
+    inline bool Mpi::verify(std::vector<char>& bytes)
+    {
+        checksum_type checksum;
+
+        if (bytes.size() < sizeof(checksum))
+            return false;
+
+        auto size = bytes.size() - sizeof(checksum);
+        std::memcpy(&checksum, bytes.data() + size, sizeof(checksum));
+        bytes.resize(size);
+
+        return checksum == utils::crc32c(bytes.data(), size);
+    }
+
+    inline std::size_t Mpi::corrupted_messages() const
+    {
+        return corrupted_messages_;
+    }
+
+    inline void Mpi::set_link(int src, const rpc::LinkFaults& faults)
+    {
+        for (int i = 0; i < static_cast<int>(links_.size()); i++)
+            if (src == MPI_ANY_SOURCE || src == i)
+                links_[i].faults = faults;
+    }
+
+    inline void Mpi::set_partitioned(int src, bool partitioned)
+    {
+        for (int i = 0; i < static_cast<int>(links_.size()); i++)
+            if (src == MPI_ANY_SOURCE || src == i)
+                links_[i].partitioned = partitioned;
+    }
+
+    inline std::size_t Mpi::dropped_messages() const
+    {
+        return dropped_messages_;
+    }
+
+    inline std::size_t Mpi::delayed_messages() const
+    {
+        return delayed_.size();
+    }
+
+    inline bool Mpi::faulty(const status& status) const
+    {
+        if (status.MPI_TAG == MessageTag::REPL
+            || status.MPI_TAG == MessageTag::METRICS)
+            return false;
+
+        const auto& link = links_[status.MPI_SOURCE];
+        const auto& faults = link.faults;
+
+        return link.partitioned || faults.latency > 0 || faults.jitter > 0
+            || faults.drop > 0 || faults.reorder > 0 || faults.duplicate > 0
+            || faults.bandwidth > 0;
+    }
+
+    inline double Mpi::draw_latency(const rpc::LinkFaults& faults)
+    {
+        using Distribution = rpc::LinkFaults::Distribution;
+
+        double delay = faults.latency;
+
+        if (faults.jitter > 0)
+        {
+            if (faults.distribution == Distribution::NORMAL)
+                delay = std::normal_distribution<double>(
+                    faults.latency, faults.jitter)(random_);
+            else if (faults.distribution == Distribution::PARETO)
+            {
+                // Lomax of shape 2, whose mean is its scale
+                double u =
+                    std::uniform_real_distribution<double>(0, 1)(random_);
+                delay += faults.jitter * (1 / std::sqrt(1 - u) - 1);
+            }
+            else
+                delay += std::uniform_real_distribution<double>(
+                    -faults.jitter, faults.jitter)(random_);
+        }
+
+        return std::max(delay, 0.);
+    }
+
+    inline std::optional<double>
+    Mpi::delivery(Channel channel, const packet& packet, double now)
+    {
+        auto& link = links_[packet.status.MPI_SOURCE];
+        const auto& faults = link.faults;
+        std::uniform_real_distribution<double> uniform(0, 1);
+
+        if (link.partitioned || uniform(random_) < faults.drop)
+            return {};
+
+        // Messages of a link go through it one after the other
+        double arrival = now;
+        if (faults.bandwidth > 0)
+        {
+            link.busy_until = std::max(link.busy_until, now)
+                + packet.bytes.size() / faults.bandwidth;
+            arrival = link.busy_until;
+        }
+
+        double time = arrival + draw_latency(faults);
+
+        // A reordered message is held up to twice the latency more, and the
+        // next ones do not wait for it
+        if (faults.reorder > 0 && uniform(random_) < faults.reorder)
+            return time
+                + uniform(random_) * std::max(2 * faults.latency, 1e-3);
+
+        // Otherwise the order of the channel is kept, as MPI does
+        time = std::max(time, link.last_delivery[channel]);
+        link.last_delivery[channel] = time;
+        return time;
+    }
+
+    inline void Mpi::duplicate(const std::pair<Channel, packet>& message,
+                               double time)
+    {
+        const auto& faults = links_[message.second.status.MPI_SOURCE].faults;
+        std::uniform_real_distribution<double> uniform(0, 1);
+
+        // The copy goes through the latency of the link again, after the
+        // message
+        if (faults.duplicate > 0 && uniform(random_) < faults.duplicate)
+            delayed_.emplace(time + draw_latency(faults), message);
+    }
+
+    inline void Mpi::complete_sends()
+    {
+        // Sends to different processes complete in any order
+        std::erase_if(pending_sends_, [](PendingSend& send) {
+            int flag;
+            MPI_Test(&send.request, &flag, MPI_STATUS_IGNORE);
+            return flag;
+        });
+    }
+
+    inline void Mpi::poll()
+    {
+        complete_sends();
+
+        double now = utils::now().count();
+
+        // Held back messages are queued before the ones received since
+        while (!delayed_.empty() && delayed_.begin()->first <= now)
+        {
+            auto node = delayed_.extract(delayed_.begin());
+            auto& [channel, packet] = node.mapped();
+            queues_[channel].push_back(std::move(packet));
+        }
+
+        for (int channel = 0; channel < NB_CHANNEL; channel++)
+        {
+            auto& queue = queues_[channel];
+            int flag;
+            packet packet;
+
+            MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, communicators_[channel],
+                       &flag, &packet.status);
+
+            while (flag)
+            {
+                int count;
+                MPI_Get_count(&packet.status, MPI_CHAR, &count);
+
+                packet.bytes.resize(count);
+                MPI_Recv(packet.bytes.data(), count, MPI_CHAR,
+                         packet.status.MPI_SOURCE, packet.status.MPI_TAG,
+                         communicators_[channel], MPI_STATUS_IGNORE);
+
+                // Drop corrupted messages, as if they were lost
+                if (!verify(packet.bytes))
+                    corrupted_messages_++;
+                else if (!faulty(packet.status))
+                    queue.push_back(std::move(packet));
+                else if (auto time = delivery(static_cast<Channel>(channel),
+                                              packet, now))
+                {
+                    auto it = delayed_.emplace(
+                        *time, std::make_pair(static_cast<Channel>(channel),
+                                              std::move(packet)));
+                    duplicate(it->second, *time);
+                }
+                else
+                    dropped_messages_++;
+
+                MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG,
+                           communicators_[channel], &flag, &packet.status);
+            }
+
+            auto& stats = queue_stats_[channel];
+            stats.max = std::max(stats.max, queue.size());
+            stats.total += queue.size();
+            stats.samples++;
+        }
+    }
+
+    inline std::optional<std::pair<Channel, Mpi::queue_type::iterator>>
+    Mpi::find(int src, int tag, bool wait)
+    {
+        do
+        {
+            poll();
+
+            for (int channel = 0; channel < NB_CHANNEL; channel++)
+            {
+                if (tag != MPI_ANY_TAG && tag_channel(tag) != channel)
+                    continue;
+
+                auto& queue = queues_[channel];
+                auto it = std::find_if(
+                    queue.begin(), queue.end(), [&](const packet& packet) {
+                        return (src == MPI_ANY_SOURCE
+                                || packet.status.MPI_SOURCE == src)
+                            && (tag == MPI_ANY_TAG
+                                || packet.status.MPI_TAG == tag);
+                    });
+
+                if (it != queue.end())
+                    return {{static_cast<Channel>(channel), it}};
+            }
+        } while (wait);
+
+        return {};
+    }
+
+    inline std::vector<char> Mpi::take(Channel channel, queue_type::iterator it)
+    {
+        auto bytes = std::move(it->bytes);
+        queues_[channel].erase(it);
+        return bytes;
+    }
 } // namespace mpi
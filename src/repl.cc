@@ -1,14 +1,31 @@
 #include "repl.hh"
 
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <sstream>
+#include <thread>
 
 #include "mpi/mpi.hh"
+#include "utils/buffer.hh"
 #include "utils/time.hh"
 
+namespace
+{
+    /// File METRICS json appends a line to, one JSON object per order
+    constexpr const char* metrics_file = "metrics.jsonl";
+
+    /// Time given to servers to answer a METRICS order, stopped ones never do
+    constexpr double metrics_timeout = 1;
+} // namespace
+
 Repl::Repl(int nb_server, int nb_client)
     : nb_server_(nb_server)
     , nb_client_(nb_client)
+    , last_commit_()
+    , last_metrics_()
 {}
 
 std::optional<Repl::Command> Repl::parse_command(std::string line)
@@ -18,7 +35,7 @@ std::optional<Repl::Command> Repl::parse_command(std::string line)
 
     iss >> str;
 
-    Command command;
+    Command command{};
 
     if (str == "SPEED")
     {
@@ -35,6 +52,70 @@ std::optional<Repl::Command> Repl::parse_command(std::string line)
             return {};
     }
 
+    else if (str == "TRANSFER")
+    {
+        command.order = Order::TRANSFER;
+
+        if (!(iss >> command.server))
+            return {};
+    }
+
+    else if (str == "ADD" || str == "REMOVE")
+    {
+        // Sent to every server, the leader of each group changes it
+        command.order = str == "ADD" ? Order::ADD : Order::REMOVE;
+
+        if (!(iss >> command.server) || command.server < 1
+            || command.server > nb_server_)
+            return {};
+    }
+
+    else if (str == "METRICS")
+    {
+        // Always asked to every server
+        command.order = Order::METRICS;
+        command.json = iss >> str && str == "json";
+        return command;
+    }
+
+    else if (str == "NET")
+    {
+        // Faults of the link from a rank to another, either of them may be *
+        std::string source;
+        std::string target;
+        if (!(iss >> source >> target))
+            return {};
+
+        auto src = parse_rank(source);
+        auto dst = parse_rank(target);
+        if (!src || !dst || !parse_faults(iss, command.faults))
+            return {};
+
+        command.order = Order::NETWORK;
+        command.source = *src ? *src : MPI_ANY_SOURCE;
+        command.target = *dst;
+        return command;
+    }
+
+    else if (str == "PARTITION" || str == "HEAL")
+    {
+        // Healing is a partition of no process
+        command.order = Order::PARTITION;
+        bool heal = str == "HEAL";
+
+        while (iss >> str)
+        {
+            auto id = parse_rank(str);
+            if (!id || !*id)
+                return {};
+            command.ranks.push_back(*id);
+        }
+
+        if (heal != command.ranks.empty())
+            return {};
+        return command;
+    }
+
     else if (str == "CRASH")
         command.order = Order::CRASH;
     else if (str == "START")
@@ -46,7 +127,18 @@ std::optional<Repl::Command> Repl::parse_command(std::string line)
     else if (str == "STOP")
         command.order = Order::STOP;
     else if (str == "WAIT")
+    {
         utils::sleep_for_ms(3000);
+        return {};
+    }
+    else if (str == "SLEEP")
+    {
+        // Scripted scenarios time their events with it
+        double seconds;
+        if (iss >> seconds && seconds > 0)
+            std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+        return {};
+    }
     else
         return {};
 
@@ -68,12 +160,95 @@ std::optional<Repl::Command> Repl::parse_command(std::string line)
     return command;
 }
 
+std::optional<int> Repl::parse_rank(const std::string& word)
+{
+    if (word == "*")
+        return 0;
+
+    try
+    {
+        int id = std::stoi(word);
+        if (id > 0 && id <= nb_server_ + nb_client_)
+            return id;
+    }
+    catch (const std::logic_error&)
+    {}
+
+    return {};
+}
+
+bool Repl::parse_faults(std::istringstream& iss, rpc::LinkFaults& faults)
+{
+    using Distribution = rpc::LinkFaults::Distribution;
+
+    faults = rpc::LinkFaults{0, 0, Distribution::UNIFORM, 0, 0, 0, 0};
+    std::string word;
+
+    while (iss >> word)
+    {
+        auto equal = word.find('=');
+        if (equal == std::string::npos)
+            return false;
+
+        auto name = word.substr(0, equal);
+        auto value = word.substr(equal + 1);
+
+        if (name == "distribution")
+        {
+            if (value == "uniform")
+                faults.distribution = Distribution::UNIFORM;
+            else if (value == "normal")
+                faults.distribution = Distribution::NORMAL;
+            else if (value == "pareto")
+                faults.distribution = Distribution::PARETO;
+            else
+                return false;
+            continue;
+        }
+
+        double number;
+        try
+        {
+            number = std::stod(value);
+        }
+        catch (const std::logic_error&)
+        {
+            return false;
+        }
+
+        if (number < 0)
+            return false;
+
+        // Delays are given in milliseconds
+        if (name == "latency")
+            faults.latency = number / 1000;
+        else if (name == "jitter")
+            faults.jitter = number / 1000;
+        else if (name == "drop" && number <= 1)
+            faults.drop = number;
+        else if (name == "reorder" && number <= 1)
+            faults.reorder = number;
+        else if (name == "duplicate" && number <= 1)
+            faults.duplicate = number;
+        else if (name == "bandwidth")
+            faults.bandwidth = number;
+        else
+            return false;
+    }
+
+    return true;
+}
+
 void Repl::execute(Command command)
 {
     std::cout << "sending message " << static_cast<char>(command.order) << " "
               << command.target << " " << command.speed_level << "\n";
 
-    rpc::Repl message{command.order, command.speed_level};
+    if (command.order == Order::PARTITION)
+        return partition(command.ranks);
+
+    rpc::Repl message{command.order,  command.speed_level, command.server,
+                      command.source, command.faults,      false};
 
     if (command.target)
     {
@@ -83,9 +258,27 @@ void Repl::execute(Command command)
         mpi_.send(command.target, message, MessageTag::REPL);
     }
 
+    else if (command.order == Order::METRICS)
+    {
+        // Drop answers which arrived after the previous order timed out
+        while (auto status =
+                   mpi_.available_message(MPI_ANY_SOURCE, MessageTag::METRICS))
+            mpi_.discard(*status);
+
+        for (int i = 1; i <= nb_server_; i++)
+            mpi_.send(i, message, MessageTag::REPL);
+
+        auto snapshots = gather_metrics();
+
+        if (command.json)
+            write_metrics(snapshots);
+        else
+            print_metrics(snapshots);
+    }
+
     else
     {
-        if (command.order == Order::STOP)
+        if (command.order == Order::STOP || command.order == Order::NETWORK)
             for (int i = 1; i <= nb_server_ + nb_client_; i++)
                 mpi_.send(i, message, MessageTag::REPL);
 
@@ -99,6 +292,189 @@ void Repl::execute(Command command)
     }
 }
 
+void Repl::partition(const std::vector<int>& ranks)
+{
+    auto nb_process = nb_server_ + nb_client_;
+    rpc::Repl message{};
+    message.order = Order::PARTITION;
+
+    if (ranks.empty())
+    {
+        message.source = MPI_ANY_SOURCE;
+        for (int i = 1; i <= nb_process; i++)
+            mpi_.send(i, message, MessageTag::REPL);
+        return;
+    }
+
+    auto cut = [&](int id) {
+        return std::find(ranks.begin(), ranks.end(), id) != ranks.end();
+    };
+
+    // Each process drops what comes from the other side
+    message.partitioned = true;
+    for (int i = 1; i <= nb_process; i++)
+    {
+        for (int j = 1; j <= nb_process; j++)
+        {
+            if (cut(i) == cut(j))
+                continue;
+
+            message.source = j;
+            mpi_.send(i, message, MessageTag::REPL);
+        }
+    }
+}
+
+std::vector<Repl::Snapshot> Repl::gather_metrics()
+{
+    std::vector<Snapshot> snapshots;
+    utils::Timeout timeout(metrics_timeout, metrics_timeout);
+
+    while (snapshots.size() < static_cast<std::size_t>(nb_server_) && !timeout)
+    {
+        auto status =
+            mpi_.available_message(MPI_ANY_SOURCE, MessageTag::METRICS);
+        if (!status)
+            continue;
+
+        utils::Buffer buffer(
+            mpi_.recv_vector<char>(status->MPI_SOURCE, MessageTag::METRICS));
+
+        auto server = buffer.pop<rpc::Metrics>();
+        snapshots.push_back(
+            Snapshot{server, buffer.pop_vector<rpc::GroupMetrics>()});
+    }
+
+    std::sort(snapshots.begin(), snapshots.end(),
+              [](const auto& a, const auto& b) {
+                  return a.server.source < b.server.source;
+              });
+
+    return snapshots;
+}
+
+std::map<int, double> Repl::commit_rates(const std::vector<Snapshot>& snapshots)
+{
+    std::map<int, int> commit;
+    for (const auto& snapshot : snapshots)
+        for (const auto& group : snapshot.groups)
+            commit[group.group] = std::max(commit[group.group],
+                                           group.commit_index);
+
+    auto now = utils::now();
+    auto elapsed = (now - last_metrics_).count();
+
+    std::map<int, double> rates;
+    for (auto [group, index] : commit)
+        if (last_commit_.contains(group) && elapsed > 0)
+            rates[group] = (index - last_commit_[group]) / elapsed;
+
+    last_commit_ = commit;
+    last_metrics_ = now;
+
+    return rates;
+}
+
+void Repl::print_metrics(const std::vector<Snapshot>& snapshots)
+{
+    auto rates = commit_rates(snapshots);
+
+    std::cout << std::left << std::setw(7) << "SERVER" << std::setw(6)
+              << "CRASH" << std::setw(9) << "SENT" << std::setw(9) << "RECV"
+              << std::setw(8) << "QUEUE" << std::setw(6) << "GROUP"
+              << std::setw(6) << "TERM" << std::setw(7) << "ROLE"
+              << std::setw(8) << "LAST" << std::setw(8) << "COMMIT"
+              << std::setw(6) << "LAG" << std::setw(9) << "THROTTLE"
+              << std::setw(10) << "COMMIT/S" << std::setw(9) << "P50_MS"
+              << "P99_MS\n";
+
+    for (const auto& [server, groups] : snapshots)
+    {
+        for (const auto& group : groups)
+        {
+            std::cout << std::setw(7) << server.source << std::setw(6)
+                      << (server.crashed ? "yes" : "no") << std::setw(9)
+                      << server.messages_sent << std::setw(9)
+                      << server.messages_received << std::setw(8)
+                      << server.control_queue + server.data_queue
+                      << std::setw(6) << group.group << std::setw(6)
+                      << group.term << std::setw(7)
+                      << (group.leader ? "leader" : "-") << std::setw(8)
+                      << group.last_log_index << std::setw(8)
+                      << group.commit_index << std::setw(6) << group.max_lag
+                      << std::setw(9) << group.throttled << std::setw(10);
+
+            if (group.leader && rates.contains(group.group))
+                std::cout << static_cast<long>(rates[group.group]);
+            else
+                std::cout << "-";
+
+            std::cout << std::fixed << std::setprecision(2) << std::setw(9)
+                      << group.commit_p50 * 1000 << group.commit_p99 * 1000
+                      << std::defaultfloat << "\n";
+        }
+    }
+
+    std::cout << std::right << snapshots.size() << "/" << nb_server_
+              << " servers answered\n";
+}
+
+void Repl::write_metrics(const std::vector<Snapshot>& snapshots)
+{
+    auto rates = commit_rates(snapshots);
+
+    std::ofstream file(metrics_file, std::ios::app);
+    file << "{\"time\":" << std::fixed << last_metrics_.count()
+         << ",\"servers\":[";
+
+    for (std::size_t i = 0; i < snapshots.size(); i++)
+    {
+        const auto& [server, groups] = snapshots[i];
+
+        file << (i ? "," : "") << "{\"rank\":" << server.source
+             << ",\"crashed\":" << std::boolalpha << server.crashed
+             << ",\"sent\":" << server.messages_sent
+             << ",\"received\":" << server.messages_received
+             << ",\"corrupted\":" << server.corrupted_messages
+             << ",\"dropped\":" << server.dropped_messages
+             << ",\"control_queue\":" << server.control_queue
+             << ",\"data_queue\":" << server.data_queue
+             << ",\"heartbeat\":" << server.heartbeat_interval
+             << ",\"groups\":[";
+
+        for (std::size_t g = 0; g < groups.size(); g++)
+        {
+            const auto& group = groups[g];
+
+            file << (g ? "," : "") << "{\"group\":" << group.group
+                 << ",\"term\":" << group.term
+                 << ",\"leader\":" << group.leader
+                 << ",\"last_log_index\":" << group.last_log_index
+                 << ",\"commit_index\":" << group.commit_index
+                 << ",\"max_lag\":" << group.max_lag
+                 << ",\"throttled\":" << group.throttled
+                 << ",\"commit_p50\":" << group.commit_p50
+                 << ",\"commit_p99\":" << group.commit_p99 << "}";
+        }
+
+        file << "]}";
+    }
+
+    file << "],\"commits_per_second\":{";
+
+    bool first = true;
+    for (auto [group, rate] : rates)
+    {
+        file << (first ? "" : ",") << "\"" << group << "\":" << rate;
+        first = false;
+    }
+
+    file << "}}\n";
+
+    std::cout << "metrics of " << snapshots.size() << "/" << nb_server_
+              << " servers written to " << metrics_file << "\n";
+}
+
 void Repl::operator()()
 {
     std::cout << "repl\n";
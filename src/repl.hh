@@ -1,11 +1,15 @@
 #pragma once
 
+#include <map>
 #include <optional>
+#include <sstream>
 #include <string>
+#include <vector>
 
 #include "common.hh"
 #include "mpi/mpi.hh"
 #include "rpc/rpc.hh"
+#include "utils/time.hh"
 
 class Repl
 {
@@ -18,6 +22,21 @@ private:
         Order order;
         int target;
         int speed_level;
+        int server;
+        // Metrics written as JSON instead of a table
+        bool json;
+        // Sender of the link a NET order applies to
+        int source;
+        rpc::LinkFaults faults;
+        // Processes a PARTITION order cuts from the others
+        std::vector<int> ranks;
+    };
+
+    /// Metrics of a server and of its groups
+    struct Snapshot
+    {
+        rpc::Metrics server;
+        std::vector<rpc::GroupMetrics> groups;
     };
 
 public:
@@ -28,7 +47,28 @@ public:
     void operator()();
 
 private:
+    /// Rank given as a number or `*` for every process, 0 for `*`
+    std::optional<int> parse_rank(const std::string& word);
+    /// Options of a NET order, as `name=value` words
+    static bool parse_faults(std::istringstream& iss, rpc::LinkFaults& faults);
+
+    /// Send a PARTITION order about each link between `ranks` and the other
+    /// processes to both ends
+    void partition(const std::vector<int>& ranks);
+
+    /// Snapshots of the servers which answered a METRICS order
+    std::vector<Snapshot> gather_metrics();
+    void print_metrics(const std::vector<Snapshot>& snapshots);
+    void write_metrics(const std::vector<Snapshot>& snapshots);
+
+    /// Commits per second of each group since the previous METRICS order
+    std::map<int, double> commit_rates(const std::vector<Snapshot>& snapshots);
+
     int nb_server_;
     int nb_client_;
     mpi::Mpi mpi_;
+
+    /// Highest commit index of each group at the previous METRICS order
+    std::map<int, int> last_commit_;
+    utils::timestamp last_metrics_;
 };
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <optional>
 
 #include "common.hh"
@@ -9,9 +10,25 @@ namespace rpc
 {
     using command_t = utils::bounded_string<64>;
 
+    /// Client of the empty entry a new leader appends to commit the entries
+    /// of the previous terms, the REPL which never sends requests
+    constexpr rank no_op_client = 0;
+
+    /// Client of the entries changing the members of a group, their command
+    /// is the new configuration, see utils::Membership
+    constexpr rank config_client = -1;
+
+    /// Whether an entry was appended by the servers themselves, no client
+    /// waits for it
+    constexpr bool internal_entry(rank client)
+    {
+        return client <= no_op_client;
+    }
+
     struct ClientRequest
     {
         rank source;
+        int group;
         unsigned id;
         command_t command;
 
@@ -25,41 +42,120 @@ namespace rpc
     struct AppendEntries
     {
         rank source;
+        int group;
         int term;
         rank leader;
         int prev_log_index;
         int prev_log_term;
         std::optional<ClientRequest> entry;
+        // Term the entry was appended in, older than `term` for the entries
+        // of previous leaders
+        int entry_term;
         int leader_commit;
+        // Send time, echoed in the response to measure the round trip time
+        double timestamp;
+        // Heartbeat interval of the leader, followers derive their election
+        // timeout from it
+        double heartbeat_interval;
+    };
+
+    /// AppendEntries carrying several entries of a sealed segment, followed
+    /// on the wire by their headers then their payloads, compressed together
+    /// as a single LZ4 block when `compressed_size` is not 0
+    struct AppendEntriesBatch
+    {
+        AppendEntries message;
+        int nb_entries;
+        std::uint32_t payload_size;
+        std::uint32_t compressed_size;
     };
 
     struct RequestVote
     {
+        int group;
         int term;
         rank candidate;
         int last_log_index;
         int last_log_term;
+        // Election requested by the leader, voters must not ignore it
+        bool transfer;
+    };
+
+    /// Sent by a leader to the server it transfers its leadership to, so that
+    /// it starts an election right away
+    struct TimeoutNow
+    {
+        rank source;
+        int group;
+        int term;
     };
 
     struct RequestVoteResponse
     {
         rank source;
+        int group;
+        int term;
         bool value;
     };
 
+    /// Followed on the wire by the ids of the requests it answers, several
+    /// commited requests of a client are notified at once
     struct ClientRequestResponse
     {
+        enum class Status : char
+        {
+            COMMITTED,
+            // Not the leader, the request goes to `leader`
+            REDIRECT,
+            // The leader is overloaded, the request is sent again after
+            // `retry_after` seconds
+            RETRY_AFTER,
+        };
+
         rank source;
-        bool value;
+        int group;
+        Status status;
         rank leader;
+        double retry_after;
     };
 
     struct AppendEntriesResponse
     {
         rank source;
+        int group;
         bool value;
         int log_index;
         int commit_index;
+        // Timestamp of the AppendEntries this responds to
+        double timestamp;
+    };
+
+    /// Faults injected on the messages a process receives on one link, see
+    /// mpi::Mpi::set_link
+    struct LinkFaults
+    {
+        enum class Distribution : char
+        {
+            // latency plus or minus jitter
+            UNIFORM = 'u',
+            // latency with a standard deviation of jitter
+            NORMAL = 'n',
+            // latency plus a heavy tailed delay of mean jitter
+            PARETO = 'p',
+        };
+
+        // Added delay, in seconds
+        double latency;
+        double jitter;
+        Distribution distribution;
+        // Probability of losing a message
+        double drop;
+        // Probability of delaying a message past the ones sent after it
+        double reorder;
+        // Probability of delivering a message twice
+        double duplicate;
+        // Bytes per second, unlimited if 0
+        double bandwidth;
     };
 
     struct Repl
@@ -72,10 +168,56 @@ namespace rpc
             RECOVERY = 'r',
             PRINT = 'p',
             STOP = 'x',
+            TRANSFER = 't',
+            METRICS = 'm',
+            NETWORK = 'n',
+            PARTITION = 'w',
+            ADD = 'a',
+            REMOVE = 'd',
         };
 
         Order order;
         int speed_level;
+        // Server the leadership is transferred to, or added to or removed
+        // from the groups
+        rank server;
+        // Sender on the link a NETWORK or PARTITION order applies to, every
+        // process if MPI_ANY_SOURCE
+        rank source;
+        LinkFaults faults;
+        // Whether a PARTITION order cuts the link or heals it
+        bool partitioned;
+    };
+
+    /// Snapshot of the state of a server sent to the REPL, followed on the
+    /// wire by one GroupMetrics per group
+    struct Metrics
+    {
+        rank source;
+        bool crashed;
+        std::uint64_t messages_sent;
+        std::uint64_t messages_received;
+        std::uint64_t corrupted_messages;
+        // Lost to injected faults, see the NET and PARTITION orders
+        std::uint64_t dropped_messages;
+        std::uint32_t control_queue;
+        std::uint32_t data_queue;
+        double heartbeat_interval;
+    };
+
+    struct GroupMetrics
+    {
+        int group;
+        int term;
+        bool leader;
+        int last_log_index;
+        int commit_index;
+        // Entries the slowest follower misses, when leader
+        int max_lag;
+        std::uint64_t throttled;
+        // Time from the reception of a request to its commit, in seconds
+        double commit_p50;
+        double commit_p99;
     };
 
 } // namespace rpc
@@ -1,5 +1,6 @@
 #include "server.hh"
 
+#include <algorithm>
 #include <assert.h>
 #include <fstream>
 #include <iostream>
@@ -7,6 +8,7 @@
 
 #include "repl.hh"
 #include "rpc/rpc.hh"
+#include "utils/crc32c.hh"
 
 #define LOG(mode) logger_ << utils::Logger::LogType::mode
 
@@ -14,25 +16,29 @@
 //                           Constructor                            //
 //------------------------------------------------------------------//
 
-Server::Server(rank rank, int nb_server)
-    : status_(Status::FOLLOWER)
-    , rank_(rank)
-    , nb_server_(nb_server)
-    , leader_(rank)
+Server::Server(rank rank, const Config& config, utils::Tracer& tracer)
+    : rank_(rank)
+    , nb_server_(config.nb_server)
     , speed_mod_(1)
-    , timeout_(0.5, 1)
-    , heartbeat_timeout_(0.1, 0.15)
-    , term_(0)
+    , heartbeat_timeout_(config.heartbeat_max, 1.5 * config.heartbeat_max)
+    , heartbeat_min_(config.heartbeat_min)
+    , heartbeat_max_(config.heartbeat_max)
+    , rtt_(config.nb_server + 1)
+    , fanout_(config.fanout)
+    , missed_heartbeats_(config.nb_server + 1)
+    , relays_()
+    , handler_time_(MessageTag::REPL + 1)
     , has_crashed_(false)
     , stop_(false)
-    , nb_vote_(0)
-    , next_index_(nb_server + 1)
-    , commit_index_(nb_server + 1)
-    , log_entries_("entries_server" + std::to_string(rank) + ".log")
-    , logs_to_be_commited_()
     , logger_("log_server" + std::to_string(rank) + ".log")
+    , mpi_()
+    , groups_()
 {
     LOG(DEBUG) << "server " << rank_ << "has PID " << getpid();
+
+    groups_.reserve(config.nb_group);
+    for (int i = 0; i < config.nb_group; i++)
+        groups_.emplace_back(i, rank_, config, mpi_, logger_, tracer);
 }
 
 Server::~Server()
@@ -57,17 +63,25 @@ void Server::update()
     if (speed_mod_ > 1)
         utils::sleep_for_ms(20 * (speed_mod_ / 3));
 
-    if (status_ == Status::LEADER)
-        leader();
+    if (heartbeat_timeout_)
+        heartbeat();
+
+    for (auto& [leader, relay] : relays_)
+        if (relay.pending && utils::now() > relay.deadline)
+            flush_relay(leader, relay);
 
-    else if (timeout_)
-        start_election();
+    for (auto& group : groups_)
+        group.update();
 
-    else if (status_ == Status::CANDIDATE)
-        candidate();
+    if (status)
+    {
+        auto start = utils::now();
+        handle_message(*status);
+        handler_time_[status->MPI_TAG].record((utils::now() - start).count());
+    }
 
-    else
-        follower();
+    for (auto& group : groups_)
+        group.flush_notifications();
 }
 
 bool Server::complete() const
@@ -92,454 +106,525 @@ void Server::write_stats() const
     for (int t = MessageTag::APPEND_ENTRIES; t < MessageTag::REPL; t++)
         if (recv.contains(t))
             file << "RECEIVE," << tag_to_str(t) << "," << recv.at(t) << "\n";
-}
-
-//------------------------------------------------------------------//
-//                            Main roles                            //
-//------------------------------------------------------------------//
-
-void Server::leader()
-{
-    if (heartbeat_timeout_)
-        return heartbeat();
 
-    auto status = mpi_.available_message();
-
-    if (!status)
-        return;
+    // Counters of every group, and the largest backlog of any of them
+    Group::Stats totals;
+    for (const auto& group : groups_)
+    {
+        totals.pre_votes += group.stats().pre_votes;
+        totals.elections += group.stats().elections;
+        totals.leaderships += group.stats().leaderships;
+        totals.step_downs += group.stats().step_downs;
+        totals.transfers += group.stats().transfers;
+
+        totals.compressed_batches += group.stats().compressed_batches;
+        totals.raw_bytes += group.stats().raw_bytes;
+        totals.compressed_bytes += group.stats().compressed_bytes;
+        totals.compress_time += group.stats().compress_time;
+        totals.decompress_time += group.stats().decompress_time;
+
+        totals.admitted += group.stats().admitted;
+        totals.throttled += group.stats().throttled;
+        totals.max_uncommitted =
+            std::max(totals.max_uncommitted, group.stats().max_uncommitted);
+        totals.max_uncommitted_bytes =
+            std::max(totals.max_uncommitted_bytes,
+                     group.stats().max_uncommitted_bytes);
+    }
 
-    if (status->MPI_TAG == MessageTag::REPL)
-        return handle_repl_request(status->MPI_SOURCE);
+    file << "ELECTION,PRE_VOTE," << totals.pre_votes << "\n";
+    file << "ELECTION,STARTED," << totals.elections << "\n";
+    file << "ELECTION,WON," << totals.leaderships << "\n";
+    file << "ELECTION,STEP_DOWN," << totals.step_downs << "\n";
+    file << "ELECTION,TRANSFER," << totals.transfers << "\n";
+
+    // Batches compressed by this server, times in microseconds
+    file << "COMPRESSION,BATCHES," << totals.compressed_batches << "\n";
+    file << "COMPRESSION,RAW_BYTES," << totals.raw_bytes << "\n";
+    file << "COMPRESSION,COMPRESSED_BYTES," << totals.compressed_bytes
+         << "\n";
+    file << "COMPRESSION,COMPRESS_TIME,"
+         << static_cast<long>(totals.compress_time * 1e6) << "\n";
+    file << "COMPRESSION,DECOMPRESS_TIME,"
+         << static_cast<long>(totals.decompress_time * 1e6) << "\n";
+
+    // Client requests accepted or asked to retry later by this leader, and
+    // the most entries and bytes it held uncommited in a group
+    file << "ADMISSION,ADMITTED," << totals.admitted << "\n";
+    file << "ADMISSION,THROTTLED," << totals.throttled << "\n";
+    file << "ADMISSION,MAX_UNCOMMITTED," << totals.max_uncommitted << "\n";
+    file << "ADMISSION,MAX_UNCOMMITTED_BYTES,"
+         << totals.max_uncommitted_bytes << "\n";
+
+    // Chosen timeouts and measured round trip times, in microseconds
+    file << "TIMEOUT,HEARTBEAT,"
+         << static_cast<long>(heartbeat_timeout_.lower_bound * 1e6) << "\n";
 
-    if (status->MPI_TAG == MessageTag::CLIENT_REQUEST)
-        return handle_client_request(status->MPI_SOURCE, status->MPI_TAG);
+    for (int i = 1; i <= nb_server_; i++)
+        if (rtt_[i])
+            file << "RTT,SERVER" << i << ","
+                 << static_cast<long>(rtt_[i].srtt() * 1e6) << "\n";
 
-    if (status->MPI_TAG == MessageTag::APPEND_ENTRIES_RESPONSE)
+    // Memory used by each log segment, in bytes
+    for (std::size_t g = 0; g < groups_.size(); g++)
     {
-        LOG(DEBUG) << "recv from server at " << __FILE__ << ":" << __LINE__;
-
-        auto recv_data = mpi_.recv<rpc::AppendEntriesResponse>(
-            status->MPI_SOURCE, status->MPI_TAG);
+        for (const auto& segment : groups_[g].memory())
+        {
+            auto name = "GROUP" + std::to_string(g) + "_SEGMENT"
+                + std::to_string(segment.first_index);
 
-        handle_append_entry_response(recv_data);
+            file << "MEMORY," << name << "_USED,"
+                 << segment.header_bytes + segment.payload_bytes << "\n";
+            file << "MEMORY," << name << "_CAPACITY,"
+                 << segment.capacity_bytes << "\n";
+        }
     }
 
-    else if (status->MPI_TAG == MessageTag::APPEND_ENTRIES)
-        handle_append_entries(status->MPI_SOURCE, status->MPI_TAG);
+    file << "CHECKSUM,CORRUPTED_MESSAGES," << mpi_.corrupted_messages()
+         << "\n";
 
-    else
-        drop_message(status->MPI_SOURCE, status->MPI_TAG);
-}
+    // Messages received but not handled yet, sampled at each poll
+    for (int c = Channel::CONTROL; c < Channel::NB_CHANNEL; c++)
+    {
+        const auto& queue = mpi_.get_queue_stats(static_cast<Channel>(c));
+        auto mean = queue.samples ? double(queue.total) / queue.samples : 0;
 
-void Server::candidate()
-{
-    // on timeout start a new election
-    if (timeout_)
-        return start_election();
+        file << "QUEUE," << channel_to_str(c) << "_MAX," << queue.max << "\n";
+        file << "QUEUE," << channel_to_str(c) << "_MEAN," << mean << "\n";
+    }
 
-    auto status = mpi_.available_message();
+    // Latencies of every group, then handler service times per tag
+    Group::Timings timings;
+    for (const auto& group : groups_)
+    {
+        timings.append.merge(group.timings().append);
+        timings.quorum.merge(group.timings().quorum);
+        timings.commit.merge(group.timings().commit);
+        timings.reply.merge(group.timings().reply);
+        timings.election.merge(group.timings().election);
+    }
 
-    if (!status)
-        return;
+    std::vector<std::pair<std::string, const utils::Histogram*>> histograms{
+        {"APPEND", &timings.append},
+        {"QUORUM", &timings.quorum},
+        {"COMMIT", &timings.commit},
+        {"REPLY", &timings.reply},
+        {"ELECTION", &timings.election},
+    };
 
-    if (status->MPI_TAG == MessageTag::REPL)
-        return handle_repl_request(status->MPI_SOURCE);
+    for (int t = MessageTag::APPEND_ENTRIES; t < MessageTag::REPL; t++)
+        if (handler_time_[t].count())
+            histograms.emplace_back("HANDLER_" + tag_to_str(t),
+                                    &handler_time_[t]);
 
-    if (status->MPI_TAG == MessageTag::VOTE)
+    // Percentiles in microseconds
+    for (const auto& [name, histogram] : histograms)
     {
-        LOG(DEBUG) << "recv from server at " << __FILE__ << ":" << __LINE__;
-        auto recv_data = mpi_.recv<rpc::RequestVoteResponse>(status->MPI_SOURCE,
-                                                             status->MPI_TAG);
+        file << "LATENCY," << name << "_COUNT," << histogram->count() << "\n";
+        file << "LATENCY," << name << "_MEAN,"
+             << static_cast<long>(histogram->mean() * 1e6) << "\n";
 
-        // If not up to date, give up election
-        if (!recv_data.value)
-        {
-            LOG(INFO) << "got a reject vote from " << recv_data.source;
-            timeout_.reset();
-            status_ = Status::FOLLOWER;
+        for (auto [suffix, p] : {std::pair{"_P50", 50.}, std::pair{"_P99", 99.},
+                                 std::pair{"_P999", 99.9}})
+            file << "LATENCY," << name << suffix << ","
+                 << static_cast<long>(histogram->percentile(p) * 1e6) << "\n";
 
-            return;
-        }
-
-        LOG(INFO) << "got a vote from " << recv_data.source;
-        nb_vote_++;
+        file << "LATENCY," << name << "_MAX,"
+             << static_cast<long>(histogram->max() * 1e6) << "\n";
     }
 
-    else if (status->MPI_TAG == MessageTag::APPEND_ENTRIES)
-        handle_append_entries(status->MPI_SOURCE, status->MPI_TAG);
-
-    else if (status->MPI_TAG == MessageTag::CLIENT_REQUEST)
-        reject_client(status->MPI_SOURCE, status->MPI_TAG);
+    // Raw buckets, the histograms of several servers are merged by adding
+    // the counts of the same buckets
+    std::ofstream buckets("histograms_server" + std::to_string(rank_)
+                          + ".csv");
+    buckets << "NAME,LOWER_NS,UPPER_NS,COUNT\n";
+
+    for (const auto& [name, histogram] : histograms)
+        histogram->for_each_bucket([&](auto lower, auto upper, auto count) {
+            buckets << name << "," << lower << "," << upper << "," << count
+                    << "\n";
+        });
+}
 
-    else if (status->MPI_TAG == MessageTag::REQUEST_VOTE)
-        handle_request_vote(status->MPI_SOURCE, status->MPI_TAG);
+//------------------------------------------------------------------//
+//                            Heartbeat                             //
+//------------------------------------------------------------------//
 
-    else
-        drop_message(status->MPI_SOURCE, status->MPI_TAG);
+void Server::heartbeat()
+{
+    heartbeat_timeout_.reset();
 
-    // If got a majority of votes, become the leader
-    if (nb_vote_ > nb_server_ / 2)
-        become_leader();
-}
+    if (fanout_)
+    {
+        std::vector<rpc::AppendEntries> heartbeats;
 
-void Server::follower()
-{
-    status_ = Status::FOLLOWER;
+        for (auto& group : groups_)
+            if (group.is_leader())
+                heartbeats.push_back(group.relayed_heartbeat());
 
-    auto status = mpi_.available_message();
+        if (!heartbeats.empty())
+            relay_heartbeat(heartbeats);
 
-    if (!status)
         return;
+    }
 
-    LOG(DEBUG) << "available tag is " << status->MPI_TAG;
-    if (status->MPI_TAG == MessageTag::REPL)
-        return handle_repl_request(status->MPI_SOURCE);
-
-    if (status->MPI_TAG == MessageTag::CLIENT_REQUEST)
-        return reject_client(status->MPI_SOURCE, status->MPI_TAG);
+    for (int i = 1; i <= nb_server_; i++)
+    {
+        if (i == rank_)
+            continue;
 
-    if (status->MPI_TAG == MessageTag::REQUEST_VOTE)
-        return handle_request_vote(status->MPI_SOURCE, status->MPI_TAG);
+        std::vector<rpc::AppendEntries> heartbeats;
 
-    if (status->MPI_TAG == MessageTag::APPEND_ENTRIES)
-        return handle_append_entries(status->MPI_SOURCE, status->MPI_TAG);
+        for (auto& group : groups_)
+            if (group.is_leader())
+                if (auto message = group.heartbeat(i))
+                    heartbeats.push_back(*message);
 
-    else
-        drop_message(status->MPI_SOURCE, status->MPI_TAG);
+        if (!heartbeats.empty())
+            mpi_.send(i, heartbeats, MessageTag::HEARTBEAT);
+    }
 }
 
-//------------------------------------------------------------------//
-//                         Leader functions                         //
-//------------------------------------------------------------------//
-
-void Server::heartbeat()
+void Server::relay_heartbeat(const std::vector<rpc::AppendEntries>& heartbeats)
 {
-    heartbeat_timeout_.reset();
+    // Servers which did not answer the last heartbeats may have crashed, do
+    // not rely on them to relay heartbeats
+    constexpr int max_missed_heartbeats = 2;
+
+    std::vector<rank> route{rank_};
 
     for (int i = 1; i <= nb_server_; i++)
     {
         if (i == rank_)
             continue;
 
-        rpc::AppendEntries message{
-            rank_, term_, leader_, -1, -1, {}, log_entries_.get_commit_index()};
+        // Entries are still sent directly to the servers lagging behind
+        for (auto& group : groups_)
+            if (group.is_leader())
+                group.replicate(i);
 
-        message.prev_log_index = next_index_[i] - 1;
-        message.prev_log_term =
-            next_index_[i] - 1 < 0 ? -1 : log_entries_[next_index_[i] - 1].term;
-
-        if (next_index_[i] > log_entries_.last_log_index())
-        {
-            LOG(INFO) << "server: " << i << " is up to date, next_index is "
-                      << next_index_[i];
+        if (missed_heartbeats_[i]++ < max_missed_heartbeats)
+            route.push_back(i);
+        else
+            mpi_.send(i, heartbeats, MessageTag::HEARTBEAT);
+    }
 
-            message.entry = std::nullopt;
-        }
+    forward_heartbeat(rank_, 0, fanout_, route, heartbeats);
+}
 
-        else
-        {
-            auto next_entry = log_entries_[next_index_[i]];
-            message.entry = next_entry.data;
-
-            LOG(INFO) << "Sending append entries to " << i
-                      << ", client_id: " << next_entry.data.source
-                      << ", request_id: " << next_entry.data.id
-                      << ", entry_command: " << message.entry->command
-                      << ", term: " << term_
-                      << ", prev_log_index: " << message.prev_log_index
-                      << ", prev_log_term: " << message.prev_log_term;
-        }
+int Server::forward_heartbeat(rank leader, int position, int fanout,
+                              const std::vector<rank>& route,
+                              const std::vector<rpc::AppendEntries>& heartbeats)
+{
+    // The route is a complete tree, stored the same way as a binary heap
+    int first_child = position * fanout + 1;
+    int last_child = std::min<int>(first_child + fanout, route.size());
 
-        mpi_.send(i, message, MessageTag::APPEND_ENTRIES);
+    for (int child = first_child; child < last_child; child++)
+    {
+        utils::Buffer buffer;
+        buffer.push(leader);
+        buffer.push(child);
+        buffer.push(fanout);
+        buffer.push(route);
+        buffer.push(heartbeats);
+
+        mpi_.send(route[child], buffer.bytes(), MessageTag::HEARTBEAT_RELAY);
     }
+
+    return std::max(last_child - first_child, 0);
 }
 
-void Server::init_next_index()
+void Server::flush_relay(rank leader, Relay& relay)
 {
-    int last_index = log_entries_.last_log_index();
-    for (int i = 1; i <= nb_server_; i++)
-        next_index_[i] = last_index + 1;
+    utils::Buffer buffer;
+    buffer.push(leader);
+    buffer.push(relay.responses);
+
+    mpi_.send(relay.parent, buffer.bytes(),
+              MessageTag::HEARTBEAT_RELAY_RESPONSE);
+
+    relay.responses.clear();
+    relay.pending = 0;
 }
 
-void Server::init_commit_index()
+void Server::measure_rtt(rank server, double timestamp)
 {
-    for (int i = 1; i <= nb_server_; i++)
-        commit_index_[i] = -1;
+    rtt_[server].add(utils::now().count() - timestamp);
 }
 
-void Server::commit_entry(int log_index, int client_id)
+void Server::adapt_timeouts()
 {
-    log_entries_.commit_next_entry();
-    LOG(INFO) << "commited log number: " << log_index;
-    logs_to_be_commited_.erase(log_index);
+    double rto = 0;
+    int sampled = 0;
+    for (const auto& rtt : rtt_)
+        if (rtt)
+        {
+            rto = std::max(rto, rtt.rto());
+            sampled++;
+        }
+
+    // Peers without samples are left out, and the configured interval is
+    // kept until round trips to a majority of the servers, this one
+    // included, are measured, e.g. not when every response is relayed
+    if (!sampled || sampled < nb_server_ / 2)
+        return;
 
-    // Notify client
-    rpc::ClientRequestResponse message{rank_, true, leader_};
-    mpi_.send(client_id, message, MessageTag::CLIENT_REQUEST_RESPONSE);
+    // A few round trips per heartbeat keep followers from timing out on a
+    // slow answer, while failures are still detected quickly on fast links
+    auto interval = std::clamp(2 * rto, heartbeat_min_, heartbeat_max_);
 
-    LOG(INFO) << "Notify client " << client_id << " for request " << log_index;
+    heartbeat_timeout_.lower_bound = interval;
+    heartbeat_timeout_.upper_bound = 1.5 * interval;
+
+    for (auto& group : groups_)
+        group.set_heartbeat_interval(interval);
 }
 
 //------------------------------------------------------------------//
-//                        Follower functions                        //
+//                            Utilities                             //
 //------------------------------------------------------------------//
 
-void Server::reject_client(int src, int tag)
+void Server::handle_message(const mpi::Mpi::status& status)
 {
-    LOG(DEBUG) << "recv from client at " << __FILE__ << ":" << __LINE__;
-    auto recv_data = mpi_.recv<rpc::ClientRequest>(src, tag);
+    int src = status.MPI_SOURCE;
+    int tag = status.MPI_TAG;
 
-    rpc::ClientRequestResponse message{rank_, false, leader_};
-    mpi_.send(recv_data.source, message, MessageTag::CLIENT_REQUEST_RESPONSE);
-}
+    LOG(DEBUG) << "available tag is " << tag;
 
-void Server::update_commit_index(int index)
-{
-    while (index > log_entries_.get_commit_index())
+    switch (tag)
     {
-        if (!log_entries_.commit_next_entry())
-            break;
-        LOG(INFO) << "commited log number: "
-                  << log_entries_.get_commit_index() + 1;
-    }
-}
+    case MessageTag::APPEND_ENTRIES:
+        return handle_append_entries(src, tag);
 
-//------------------------------------------------------------------//
-//                            Elections                             //
-//------------------------------------------------------------------//
+    case MessageTag::APPEND_ENTRIES_BATCH:
+        return handle_append_entries_batch(src, tag);
 
-void Server::vote(int server)
-{
-    LOG(INFO) << "voting for " << server;
-    timeout_.reset();
-
-    rpc::RequestVoteResponse message{rank_, true};
-    mpi_.send(server, message, MessageTag::VOTE);
-}
+    case MessageTag::HEARTBEAT:
+        return handle_heartbeat(src, tag);
 
-void Server::become_leader()
-{
-    heartbeat();
-    init_next_index();
-    init_commit_index();
-    status_ = Status::LEADER;
-    leader_ = rank_;
-    LOG(INFO) << "become the leader";
-
-    // Only keep what has been commited in the log
-    log_entries_.delete_from_index(log_entries_.get_commit_index() + 1);
-}
+    case MessageTag::HEARTBEAT_RESPONSE:
+        return handle_heartbeat_response(src, tag);
 
-void Server::start_election()
-{
-    LOG(INFO) << "Become candidate";
-    status_ = Status::CANDIDATE;
-    timeout_.reset();
-    update_term();
+    case MessageTag::APPEND_ENTRIES_RESPONSE: {
+        auto recv_data = mpi_.recv<rpc::AppendEntriesResponse>(src, tag);
+        return handle_responses({recv_data});
+    }
 
-    // Ask for votes
-    auto message = rpc::RequestVote{term_, rank_, log_entries_.last_log_index(),
-                                    log_entries_.last_log_term()};
+    case MessageTag::HEARTBEAT_RELAY:
+        return handle_heartbeat_relay(src, tag);
 
-    broadcast(message, MessageTag::REQUEST_VOTE);
-    nb_vote_ = 1; // Vote for itself
+    case MessageTag::HEARTBEAT_RELAY_RESPONSE:
+        return handle_heartbeat_relay_response(src, tag);
 
-    candidate();
-}
-//------------------------------------------------------------------//
-//                            Utilities                             //
-//------------------------------------------------------------------//
+    case MessageTag::CLIENT_REQUEST: {
+        auto recv_data = mpi_.recv_vector<rpc::ClientRequest>(src, tag);
+        if (recv_data.empty())
+            return;
+        if (!valid_group(recv_data.front().group))
+        {
+            LOG(ERROR) << "requests for an unknown group, discarding them";
+            return;
+        }
+        return groups_[recv_data.front().group].handle_client_request(
+            recv_data);
+    }
 
-void Server::update_term()
-{
-    update_term(term_ + 1);
-}
+    case MessageTag::REQUEST_VOTE: {
+        auto recv_data = mpi_.recv<rpc::RequestVote>(src, tag);
+        return groups_[recv_data.group].handle_request_vote(recv_data);
+    }
 
-void Server::update_term(int term)
-{
-    if (term >= term_)
-        term_ = term;
+    case MessageTag::VOTE: {
+        auto recv_data = mpi_.recv<rpc::RequestVoteResponse>(src, tag);
+        return groups_[recv_data.group].handle_vote(recv_data);
+    }
 
-    LOG(INFO) << "current term: " << term_;
-}
+    case MessageTag::PRE_VOTE: {
+        auto recv_data = mpi_.recv<rpc::RequestVote>(src, tag);
+        return groups_[recv_data.group].handle_pre_vote(recv_data);
+    }
 
-void Server::append_entries(int term, rpc::ClientRequest data)
-{
-    LOG(INFO) << "AppendEntries: index = " << log_entries_.size()
-              << ", term: " << term << ", client: " << data.source
-              << ", command: " << data.command << ", id " << data.id;
+    case MessageTag::TIMEOUT_NOW: {
+        auto recv_data = mpi_.recv<rpc::TimeoutNow>(src, tag);
+        return groups_[recv_data.group].handle_timeout_now(recv_data);
+    }
 
-    log_entries_.append_entry(term, data);
-}
+    case MessageTag::PRE_VOTE_RESPONSE: {
+        auto recv_data = mpi_.recv<rpc::RequestVoteResponse>(src, tag);
+        return groups_[recv_data.group].handle_pre_vote_response(recv_data);
+    }
 
-void Server::broadcast(const rpc::RequestVote& message, int tag)
-{
-    for (auto i = 1; i <= nb_server_; i++)
-        if (i != rank_)
-            mpi_.send(i, message, tag);
+    default:
+        return drop_message(status);
+    }
 }
 
 void Server::ignore_messages()
 {
     while (auto status = mpi_.available_message())
     {
+        // Handle the order right away, the next probe may return another
+        // message first
         if (status->MPI_TAG == MessageTag::REPL)
-            break;
+            return handle_repl_request(status->MPI_SOURCE);
 
-        drop_message(status->MPI_SOURCE, status->MPI_TAG);
+        drop_message(*status);
     }
 }
 
-void Server::drop_message(int src, int tag)
+bool Server::valid_group(int group) const
+{
+    return group >= 0 && static_cast<std::size_t>(group) < groups_.size();
+}
+
+void Server::drop_message(const mpi::Mpi::status& status)
 {
-    LOG(WARN) << "dropping message from :" << src << " with tag " << tag;
+    LOG(WARN) << "dropping message from :" << status.MPI_SOURCE
+              << " with tag " << status.MPI_TAG;
 
-    // AppendEntries is the biggest RPC
-    mpi_.recv<rpc::AppendEntries>(src, tag);
+    mpi_.discard(status);
 }
 
 //------------------------------------------------------------------//
 //                         Message handlers                         //
 //------------------------------------------------------------------//
 
-void Server::handle_append_entry_response(
-    const rpc::AppendEntriesResponse& recv_data)
+void Server::handle_append_entries(int src, int tag)
 {
-    LOG(INFO) << "received append_entry_response from server :"
-              << recv_data.source << ", added log: " << std::boolalpha
-              << recv_data.value;
-
-    next_index_[recv_data.source] = recv_data.log_index + 1;
-    commit_index_[recv_data.source] = recv_data.commit_index;
-
-    LOG(INFO) << "server :" << recv_data.source
-              << " next index: " << next_index_[recv_data.source]
-              << " commit index: " << commit_index_[recv_data.source];
-
-    if (recv_data.value && logs_to_be_commited_.contains(recv_data.log_index))
-    {
-        auto nb_ack = ++logs_to_be_commited_[recv_data.log_index];
+    LOG(DEBUG) << "recv from server at " << __FILE__ << ":" << __LINE__;
+    auto recv_data = mpi_.recv<rpc::AppendEntries>(src, tag);
 
-        if (nb_ack > nb_server_ / 2
-            && log_entries_.get_commit_index() == recv_data.log_index - 1)
-        {
-            commit_entry(recv_data.log_index,
-                         log_entries_[recv_data.log_index].data.source);
-
-            int i = recv_data.log_index + 1;
-            while (logs_to_be_commited_.contains(i)
-                   && logs_to_be_commited_[i] > nb_server_ / 2)
-            {
-                commit_entry(i, log_entries_[i].data.source);
-                i++;
-            }
-        }
-    }
+    auto message = groups_[recv_data.group].handle_append_entries(recv_data);
+    mpi_.send(src, message, MessageTag::APPEND_ENTRIES_RESPONSE);
 }
 
-void Server::handle_append_entries(int src, int tag)
+void Server::handle_append_entries_batch(int src, int tag)
 {
     LOG(DEBUG) << "recv from server at " << __FILE__ << ":" << __LINE__;
-    auto recv_data = mpi_.recv<rpc::AppendEntries>(src, tag);
+    utils::Buffer buffer(mpi_.recv_vector<char>(src, tag));
 
-    rpc::AppendEntriesResponse message{rank_, false,
-                                       log_entries_.last_log_index(),
-                                       log_entries_.get_commit_index()};
-
-    if (recv_data.term < term_
-        || log_entries_.get_commit_index() > recv_data.leader_commit)
+    if (!buffer.has<rpc::AppendEntriesBatch>())
     {
-        LOG(INFO) << "rejecting append entries term:" << recv_data.term << "|"
-                  << term_;
-
-        update_term(recv_data.term);
-        mpi_.send(leader_, message, MessageTag::APPEND_ENTRIES_RESPONSE);
+        LOG(ERROR) << "truncated batch from " << src << ", discarding it";
         return;
     }
 
-    leader_ = recv_data.source;
-    status_ = Status::FOLLOWER;
-    timeout_.reset();
+    auto batch = buffer.pop<rpc::AppendEntriesBatch>();
 
-    if (recv_data.prev_log_index > log_entries_.last_log_index()
-        || recv_data.prev_log_term > log_entries_.last_log_term())
+    if (!valid_group(batch.message.group) || batch.nb_entries <= 0)
     {
-        LOG(INFO) << "rejecting append entries term:" << recv_data.term << "|"
-                  << term_ << " prev log_index : " << recv_data.prev_log_index
-                  << "|" << log_entries_.last_log_index()
-                  << " log term:" << recv_data.prev_log_term << "|"
-                  << log_entries_.last_log_term();
+        LOG(ERROR) << "invalid batch from " << src << ", discarding it";
+        return;
+    }
 
-        if (recv_data.prev_log_term > log_entries_.last_log_term())
-        {
-            log_entries_.delete_from_index(recv_data.prev_log_index);
-            message.log_index = log_entries_.last_log_index();
-        }
+    auto size = batch.compressed_size
+        ? batch.compressed_size
+        : batch.nb_entries * sizeof(utils::LogEntries::Header)
+            + batch.payload_size;
 
-        return mpi_.send(leader_, message, MessageTag::APPEND_ENTRIES_RESPONSE);
+    if (!buffer.has<char>(size))
+    {
+        LOG(ERROR) << "truncated batch from " << src << ", discarding it";
+        return;
     }
 
-    if (log_entries_.last_log_index() > recv_data.prev_log_index
-        && recv_data.term != log_entries_[recv_data.prev_log_index + 1].term)
-    {
-        LOG(INFO) << "delete from index " << recv_data.prev_log_index + 1;
+    auto data = buffer.view<char>(size);
 
-        log_entries_.delete_from_index(recv_data.prev_log_index + 1);
-    }
+    auto message =
+        groups_[batch.message.group].handle_append_entries_batch(batch, data);
+    mpi_.send(src, message, MessageTag::APPEND_ENTRIES_RESPONSE);
+}
 
-    // No entry, message is just a heartbeat
-    if (recv_data.entry)
-        append_entries(recv_data.term, *recv_data.entry);
+void Server::handle_heartbeat(int src, int tag)
+{
+    LOG(DEBUG) << "recv from server at " << __FILE__ << ":" << __LINE__;
+    auto recv_data = mpi_.recv_vector<rpc::AppendEntries>(src, tag);
 
-    update_commit_index(recv_data.leader_commit);
-    update_term(recv_data.term);
+    std::vector<rpc::AppendEntriesResponse> messages;
+    messages.reserve(recv_data.size());
 
-    message.value = recv_data.entry.has_value();
-    message.log_index = log_entries_.last_log_index();
-    message.commit_index = log_entries_.get_commit_index();
+    for (const auto& heartbeat : recv_data)
+        messages.push_back(
+            groups_[heartbeat.group].handle_append_entries(heartbeat));
 
-    LOG(INFO) << "accept append entries " << message.commit_index << "/"
-              << message.log_index;
+    mpi_.send(src, messages, MessageTag::HEARTBEAT_RESPONSE);
+}
 
-    mpi_.send(leader_, message, MessageTag::APPEND_ENTRIES_RESPONSE);
+void Server::handle_heartbeat_response(int src, int tag)
+{
+    LOG(DEBUG) << "recv from server at " << __FILE__ << ":" << __LINE__;
+    handle_responses(mpi_.recv_vector<rpc::AppendEntriesResponse>(src, tag));
 }
 
-void Server::handle_client_request(int src, int tag)
+void Server::handle_heartbeat_relay(int src, int tag)
 {
-    LOG(DEBUG) << "recv from client at " << __FILE__ << ":" << __LINE__;
+    LOG(DEBUG) << "recv from server at " << __FILE__ << ":" << __LINE__;
+    utils::Buffer buffer(mpi_.recv_vector<char>(src, tag));
 
-    auto recv_data = mpi_.recv<rpc::ClientRequest>(src, tag);
+    auto leader = buffer.pop<rank>();
+    auto position = buffer.pop<int>();
+    auto fanout = buffer.pop<int>();
+    auto route = buffer.pop_vector<rank>();
+    auto heartbeats = buffer.pop_vector<rpc::AppendEntries>();
 
-    LOG(INFO) << "received message from client:" << recv_data.source;
+    auto& relay = relays_[leader];
 
-    append_entries(term_, recv_data);
+    // Do not hold the answers of the previous round any longer
+    if (relay.pending)
+        flush_relay(leader, relay);
 
-    logs_to_be_commited_.try_emplace(log_entries_.last_log_index(), 1);
+    relay.parent = src;
+
+    for (const auto& heartbeat : heartbeats)
+        relay.responses.push_back(
+            groups_[heartbeat.group].handle_append_entries(heartbeat));
+
+    relay.pending =
+        forward_heartbeat(leader, position, fanout, route, heartbeats);
+
+    if (!relay.pending)
+        return flush_relay(leader, relay);
+
+    // Wait for the children at most half a heartbeat interval
+    relay.deadline = utils::now()
+        + utils::timestamp(heartbeats.front().heartbeat_interval / 2);
 }
 
-void Server::handle_request_vote(int src, int tag)
+void Server::handle_heartbeat_relay_response(int src, int tag)
 {
     LOG(DEBUG) << "recv from server at " << __FILE__ << ":" << __LINE__;
-    auto recv_data = mpi_.recv<rpc::RequestVote>(src, tag);
+    utils::Buffer buffer(mpi_.recv_vector<char>(src, tag));
 
-    if (term_ <= recv_data.term)
-    {
-        update_term(recv_data.term);
+    auto leader = buffer.pop<rank>();
+    auto responses = buffer.pop_vector<rpc::AppendEntriesResponse>();
 
-        if (log_entries_.last_log_index() <= recv_data.last_log_index
-            && log_entries_.last_log_term() <= recv_data.last_log_term)
-        {
-            vote(recv_data.candidate);
-        }
-        else
-        {
-            LOG(INFO) << "rejecting vote for " << src;
+    if (leader == rank_)
+        return handle_responses(responses, true);
 
-            rpc::RequestVoteResponse message{rank_, false};
-            mpi_.send(src, message, MessageTag::VOTE);
-            start_election();
-        }
+    auto& relay = relays_[leader];
+    relay.responses.insert(relay.responses.end(), responses.begin(),
+                           responses.end());
+
+    // Late answers are forwarded right away
+    if (relay.pending <= 1)
+        return flush_relay(leader, relay);
+
+    relay.pending--;
+}
+
+void Server::handle_responses(
+    const std::vector<rpc::AppendEntriesResponse>& data, bool relayed)
+{
+    for (const auto& response : data)
+    {
+        missed_heartbeats_[response.source] = 0;
+        if (!relayed)
+            measure_rtt(response.source, response.timestamp);
+        groups_[response.group].handle_append_entry_response(response);
     }
+
+    adapt_timeouts();
 }
 
 void Server::handle_repl_request(int src)
@@ -555,28 +640,33 @@ void Server::handle_repl_request(int src)
         std::cout << "   PID: " << getpid() << "\n";
         std::cout << " Speed: " << speed_mod_ << "\n";
         std::cout << " Crash: " << std::boolalpha << has_crashed_ << "\n";
-        std::cout << "Leader: " << leader_ << "\n";
+        std::cout << " Hbeat: " << heartbeat_timeout_.lower_bound * 1000
+                  << " ms\n";
 
-        if (!has_crashed_ && leader_ == rank_)
-        {
-            next_index_[rank_] = log_entries_.size();
-            commit_index_[rank_] = log_entries_.get_commit_index();
-            std::cout << "NxtIdx: ";
-            for (int i = 1; i <= nb_server_; i++)
-                std::cout << next_index_[i] << " ";
-            std::cout << "\n";
-
-            std::cout << "Commit: ";
-            for (int i = 1; i <= nb_server_; i++)
-                std::cout << commit_index_[i] << " ";
-            std::cout << "\n";
-        }
+        std::cout << "   RTT: ";
+        for (int i = 1; i <= nb_server_; i++)
+            std::cout << rtt_[i].srtt() * 1000 << " ";
+        std::cout << "ms\n";
+
+        std::cout << "   CRC: " << utils::crc32c_implementation() << ", "
+                  << mpi_.corrupted_messages() << " corrupted messages\n";
+
+        std::cout << " Queue: " << mpi_.queue_depth(Channel::CONTROL)
+                  << " control, " << mpi_.queue_depth(Channel::DATA)
+                  << " data\n";
+
+        std::cout << "   Net: " << mpi_.dropped_messages() << " dropped, "
+                  << mpi_.delayed_messages() << " delayed messages\n";
+
+        for (auto& group : groups_)
+            group.print(std::cout);
 
-        std::cout << "  Term: " << term_ << "\n";
-        std::cout << "NbLogs: " << log_entries_.get_commit_index() + 1 << "/"
-                  << log_entries_.size() << "\n\n";
+        std::cout << "\n";
     }
 
+    if (message.order == Repl::Order::METRICS)
+        send_metrics(src);
+
     if (message.order == Repl::Order::SPEED)
         speed_mod_ = message.speed_level;
 
@@ -587,16 +677,65 @@ void Server::handle_repl_request(int src)
     {
         LOG(DEBUG) << "recover";
         has_crashed_ = false;
-        status_ = Status::FOLLOWER;
 
-        // Only keep what has been commited in the log
-        log_entries_.delete_from_index(log_entries_.get_commit_index() + 1);
-        timeout_.reset();
+        for (auto& group : groups_)
+            group.recover();
     }
 
+    if (message.order == Repl::Order::TRANSFER && !has_crashed_)
+        for (auto& group : groups_)
+            group.transfer_leadership(message.server);
+
+    if (message.order == Repl::Order::ADD && !has_crashed_)
+        for (auto& group : groups_)
+            group.add_server(message.server);
+
+    if (message.order == Repl::Order::REMOVE && !has_crashed_)
+        for (auto& group : groups_)
+            group.remove_server(message.server);
+
+    if (message.order == Repl::Order::NETWORK)
+        mpi_.set_link(message.source, message.faults);
+
+    if (message.order == Repl::Order::PARTITION)
+        mpi_.set_partitioned(message.source, message.partitioned);
+
     if (message.order == Repl::Order::STOP)
         stop_ = true;
 
-    timeout_.speed_mod = speed_mod_;
     heartbeat_timeout_.speed_mod = speed_mod_;
+    for (auto& group : groups_)
+        group.set_speed(speed_mod_);
+}
+
+void Server::send_metrics(int src)
+{
+    auto [sent, recv] = mpi_.get_stats();
+
+    rpc::Metrics metrics{rank_,
+                         has_crashed_,
+                         0,
+                         0,
+                         mpi_.corrupted_messages(),
+                         mpi_.dropped_messages(),
+                         static_cast<std::uint32_t>(
+                             mpi_.queue_depth(Channel::CONTROL)),
+                         static_cast<std::uint32_t>(
+                             mpi_.queue_depth(Channel::DATA)),
+                         heartbeat_timeout_.lower_bound};
+
+    for (const auto& [tag, count] : sent)
+        metrics.messages_sent += count;
+    for (const auto& [tag, count] : recv)
+        metrics.messages_received += count;
+
+    std::vector<rpc::GroupMetrics> groups;
+    for (const auto& group : groups_)
+        groups.push_back(group.metrics());
+
+    utils::Buffer buffer;
+    buffer.push(metrics);
+    buffer.push(groups);
+
+    mpi_.send(src, buffer.bytes(), MessageTag::METRICS);
 }
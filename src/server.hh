@@ -8,21 +8,21 @@
 
 #include "client.hh"
 #include "common.hh"
-#include "utils/log_entries.hh"
+#include "config.hh"
+#include "group.hh"
+#include "utils/buffer.hh"
+#include "utils/histogram.hh"
 #include "utils/logger.hh"
+#include "utils/rtt.hh"
 #include "utils/time.hh"
+#include "utils/trace.hh"
 
+/// A server process, hosting one or several consensus groups which share its
+/// transport, timers and event loop
 class Server
 {
 public:
-    enum class Status
-    {
-        FOLLOWER,
-        CANDIDATE,
-        LEADER,
-    };
-
-    Server(rank rank, int nb_server);
+    Server(rank rank, const Config& config, utils::Tracer& tracer);
     ~Server();
 
     /// Main functions
@@ -33,108 +33,125 @@ public:
     /// Has the system logged all client requests
     bool complete() const;
 
-    /// Get stats about the number of messages sent and received
+    /// Get stats about the number of messages sent and received, and the
+    /// latency histograms, to stats_server<rank>.csv and
+    /// histograms_server<rank>.csv
     void write_stats() const;
     /// \}
 
 private:
-    /// Process round depending on status
-    /// \{
-    void leader();
-    void candidate();
-    void follower();
-    /// \}
+    /// Heartbeats relayed for a leader when they are fanned out through a tree
+    struct Relay
+    {
+        /// Server the heartbeat was received from
+        rank parent;
 
-    /// Leader
-    /// \{
+        /// Number of children which did not answer yet
+        int pending;
+
+        /// Responses aggregated before being sent to the parent
+        std::vector<rpc::AppendEntriesResponse> responses;
+
+        /// Time after which the responses are sent without waiting for the
+        /// remaining children
+        utils::timestamp deadline;
+    };
+
+    /// Send the heartbeats of every group led by this server, coalesced per
+    /// destination
     void heartbeat();
-    void init_next_index();
-    void init_commit_index();
-    // Add entry to commit log
-    void commit_entry(int log_index, int client_id);
-    /// \}
 
-    /// Follower
-    /// \{
-    void reject_client(int src, int tag);
-    void update_commit_index(int index);
-    /// \}
+    /// Fan out the heartbeats through a tree of the servers that answered
+    /// recently, the others get them directly
+    void relay_heartbeat(const std::vector<rpc::AppendEntries>& heartbeats);
 
-    /// Elections
-    /// \{
-    void vote(int server);
-    void become_leader();
-    void start_election();
-    /// \}
+    /// Send the heartbeats to the children of `position` in `route`, return
+    /// the number of children
+    int forward_heartbeat(rank leader, int position, int fanout,
+                          const std::vector<rank>& route,
+                          const std::vector<rpc::AppendEntries>& heartbeats);
+
+    /// Send the responses aggregated for `leader` to the parent
+    void flush_relay(rank leader, Relay& relay);
+
+    /// Account for the round trip time of an AppendEntries sent at
+    /// `timestamp` to `server`
+    void measure_rtt(rank server, double timestamp);
+
+    /// Adapt the heartbeat interval to the slowest link
+    void adapt_timeouts();
 
     /// Utilities
     /// \{
-    void update_term();
-    void update_term(int term);
-    void append_entries(int term, rpc::ClientRequest data);
-    void broadcast(const rpc::RequestVote& message, int tag);
+    // Dispatch an incoming message to its group
+    void handle_message(const mpi::Mpi::status& status);
     // Ignore messages if crashed
     void ignore_messages();
     // Drop incoming message
-    void drop_message(int src, int tag);
+    void drop_message(const mpi::Mpi::status& status);
+    // Whether a group id received from another process exists
+    bool valid_group(int group) const;
     /// \}
 
     /// Handlers
     /// \{
-    void
-    handle_append_entry_response(const rpc::AppendEntriesResponse& recv_data);
     void handle_append_entries(int src, int tag);
-    void handle_client_request(int src, int tag);
-    void handle_request_vote(int src, int tag);
+    void handle_append_entries_batch(int src, int tag);
+    void handle_heartbeat(int src, int tag);
+    void handle_heartbeat_response(int src, int tag);
+    void handle_heartbeat_relay(int src, int tag);
+    void handle_heartbeat_relay_response(int src, int tag);
+    // Process responses to heartbeats sent by this server. Relayed ones
+    // waited for the other children of their relays and are no round trip
+    // time samples.
+    void handle_responses(const std::vector<rpc::AppendEntriesResponse>& data,
+                          bool relayed = false);
     void handle_repl_request(int src);
+    // Answer a METRICS order with a snapshot of the server and its groups
+    void send_metrics(int src);
     /// \}
 
 private:
-    /// Status of the server
-    Status status_;
-
     /// Rank of the server
     rank rank_;
 
     /// Size of the network
     int nb_server_;
 
-    /// Rank of the leader
-    rank leader_;
-
     /// Speed slow modifier
     int speed_mod_;
 
-    /// Timestamp of the timeout
-    utils::Timeout timeout_;
-
-    /// Timestamp of the timeout
+    /// Timestamp of the heartbeat timeout, shared by all groups
     utils::Timeout heartbeat_timeout_;
 
-    /// Current term
-    int term_;
+    /// Limits of the heartbeat interval
+    double heartbeat_min_;
+    double heartbeat_max_;
 
-    /// Crash status
-    bool has_crashed_;
+    /// Round trip time to each server
+    std::vector<utils::RttEstimator> rtt_;
 
-    /// Whether the process should stop
-    bool stop_;
+    /// Number of children of each node of the heartbeat tree, 0 if disabled
+    int fanout_;
 
-    /// number of vote in current election
-    int nb_vote_;
+    /// Heartbeats sent to each server since its last answer
+    std::vector<int> missed_heartbeats_;
 
-    /// index of the next log entry to send to that server
-    std::vector<int> next_index_;
+    /// Heartbeats relayed for each leader
+    std::map<rank, Relay> relays_;
 
-    /// commit index on each server
-    std::vector<int> commit_index_;
+    /// Time spent handling each type of message
+    std::vector<utils::Histogram> handler_time_;
 
-    /// Log entries
-    utils::LogEntries log_entries_;
+    /// Crash status
+    bool has_crashed_;
 
-    // Map log index on nb_acknowledge
-    std::map<int, int> logs_to_be_commited_;
+    /// Whether the process should stop
+    bool stop_;
 
     utils::Logger logger_;
     mpi::Mpi mpi_;
+
+    /// Consensus groups hosted by this server
+    std::vector<Group> groups_;
 };
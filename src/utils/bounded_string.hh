@@ -21,6 +21,13 @@ namespace utils
             (*this)[len] = 0;
         }
 
+        bounded_string(const char* s, std::size_t len)
+        {
+            len = std::min(N - 1, len);
+            std::memcpy(data_, s, len);
+            std::memset(data_ + len, 0, N - len);
+        }
+
         bounded_string(const bounded_string& s)
         {
             std::memcpy(data_, s.data_, N);
@@ -39,6 +46,17 @@ namespace utils
             return std::string(data_);
         }
 
+        inline const char* data() const
+        {
+            return data_;
+        }
+
+        /// Number of characters before the terminating null byte
+        inline std::size_t size() const
+        {
+            return strnlen(data_, N);
+        }
+
         inline char& operator[](std::size_t i)
         {
             return data_[i];
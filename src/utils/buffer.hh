@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstring>
+#include <vector>
+
+namespace utils
+{
+    /// Byte buffer used to send messages made of several parts of various
+    /// sizes. Values are copied as is, the same way single messages are.
+    class Buffer
+    {
+    public:
+        Buffer() = default;
+
+        Buffer(std::vector<char> bytes)
+            : bytes_(std::move(bytes))
+            , read_pos_(0)
+        {}
+
+        template <typename T>
+        inline void push(const T& value)
+        {
+            auto pos = bytes_.size();
+            bytes_.resize(pos + sizeof(T));
+            std::memcpy(bytes_.data() + pos, &value, sizeof(T));
+        }
+
+        template <typename T>
+        inline void push(const std::vector<T>& values)
+        {
+            push(values.size());
+
+            auto pos = bytes_.size();
+            bytes_.resize(pos + values.size() * sizeof(T));
+            std::memcpy(bytes_.data() + pos, values.data(),
+                        values.size() * sizeof(T));
+        }
+
+        template <typename T>
+        inline T pop()
+        {
+            T value;
+            std::memcpy(static_cast<void*>(&value), bytes_.data() + read_pos_,
+                        sizeof(T));
+            read_pos_ += sizeof(T);
+            return value;
+        }
+
+        template <typename T>
+        inline std::vector<T> pop_vector()
+        {
+            auto size = pop<std::size_t>();
+
+            std::vector<T> values(size);
+            std::memcpy(static_cast<void*>(values.data()),
+                        bytes_.data() + read_pos_,
+                        size * sizeof(T));
+            read_pos_ += size * sizeof(T);
+
+            return values;
+        }
+
+        /// Point to `count` values in the buffer instead of copying them
+        template <typename T>
+        inline const T* view(std::size_t count)
+        {
+            auto values = reinterpret_cast<const T*>(bytes_.data() + read_pos_);
+            read_pos_ += count * sizeof(T);
+            return values;
+        }
+
+        /// Whether `count` values are left to read, for received buffers
+        /// whose sizes come from the sender
+        template <typename T>
+        inline bool has(std::size_t count = 1) const
+        {
+            return count <= (bytes_.size() - read_pos_) / sizeof(T);
+        }
+
+        inline const std::vector<char>& bytes() const
+        {
+            return bytes_;
+        }
+
+    private:
+        std::vector<char> bytes_;
+        std::size_t read_pos_ = 0;
+    };
+} // namespace utils
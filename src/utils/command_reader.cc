@@ -0,0 +1,122 @@
+#include "utils/command_reader.hh"
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+namespace utils
+{
+    // Pages of commands already sent are released by chunks, so that a
+    // workload much larger than memory is replayed with constant memory
+    static constexpr std::size_t release_chunk = 64 << 20;
+
+    CommandReader::CommandReader(const std::string& path)
+        : file_(path)
+        , binary_(false)
+        , position_(0)
+        , next_()
+        , released_(0)
+    {
+        if (!file_)
+            return;
+
+        madvise(const_cast<char*>(file_.data()), file_.size(),
+                MADV_SEQUENTIAL);
+
+        auto header = std::string_view(file_.data(), file_.size())
+                          .substr(0, binary_magic.size());
+        if (header == binary_magic)
+        {
+            binary_ = true;
+            position_ = binary_magic.size();
+        }
+
+        parse();
+    }
+
+    std::optional<std::string_view> CommandReader::peek() const
+    {
+        return next_;
+    }
+
+    void CommandReader::pop()
+    {
+        parse();
+
+        if (position_ - released_ >= release_chunk)
+            release();
+    }
+
+    bool CommandReader::done() const
+    {
+        return !next_;
+    }
+
+    void CommandReader::parse()
+    {
+        next_.reset();
+
+        const char* data = file_.data();
+        std::size_t size = file_.size();
+
+        if (binary_)
+        {
+            std::uint32_t length;
+            if (size - position_ < sizeof(length))
+                return;
+
+            std::memcpy(&length, data + position_, sizeof(length));
+            position_ += sizeof(length);
+
+            if (length > size - position_)
+            {
+                std::cerr << "truncated command at offset " << position_
+                          << ", stopping\n";
+                position_ = size;
+                return;
+            }
+
+            next_ = std::string_view(data + position_, length);
+            position_ += length;
+            return;
+        }
+
+        // Empty lines are skipped, spaces are part of the command
+        while (position_ < size)
+        {
+            const char* begin = data + position_;
+            auto end = static_cast<const char*>(
+                std::memchr(begin, '\n', size - position_));
+            if (!end)
+                end = data + size;
+
+            position_ = end - data + (end != data + size);
+
+            std::string_view line(begin, end - begin);
+            if (!line.empty() && line.back() == '\r')
+                line.remove_suffix(1);
+
+            if (!line.empty())
+            {
+                next_ = line;
+                return;
+            }
+        }
+    }
+
+    void CommandReader::release()
+    {
+        static const std::size_t page_size = sysconf(_SC_PAGESIZE);
+
+        // Keep the page of the next command
+        std::size_t start = next_ ? next_->data() - file_.data() : position_;
+        std::size_t end = start / page_size * page_size;
+
+        if (end <= released_)
+            return;
+
+        madvise(const_cast<char*>(file_.data()) + released_, end - released_,
+                MADV_DONTNEED);
+        released_ = end;
+    }
+} // namespace utils
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "utils/mapped_file.hh"
+
+namespace utils
+{
+    /// Commands of a workload file, read one at a time from a mapping of the
+    /// file so that memory does not grow with its size. Commands are either
+    /// lines of text, or in the binary format: `binary_magic` followed by
+    /// each command prefixed by its length on 4 little endian bytes.
+    class CommandReader
+    {
+    public:
+        static constexpr std::string_view binary_magic{"ALGOREP\x01", 8};
+
+        CommandReader(const std::string& path);
+
+        /// Next command, valid until the following pop()
+        std::optional<std::string_view> peek() const;
+        void pop();
+
+        bool done() const;
+
+    private:
+        /// Find the command starting at `position_`
+        void parse();
+
+        /// Let the kernel drop the pages of the commands already read
+        void release();
+
+        MappedFile file_;
+        bool binary_;
+
+        /// Offset of the command after `next_`
+        std::size_t position_;
+        std::optional<std::string_view> next_;
+
+        /// Offset up to which pages were released
+        std::size_t released_;
+    };
+} // namespace utils
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+namespace utils
+{
+    /// Binary export of the commited entries of a log, checked against the
+    /// exports of the other replicas by tools/check_logs: `magic` followed by
+    /// one Record per index from 0. Each record chains the hash of the
+    /// previous one, so two replicas agree up to an index if and only if their
+    /// hashes at that index are equal.
+    namespace committed_log
+    {
+        static constexpr std::string_view magic{"ALGOLOG\x01", 8};
+
+        struct Record
+        {
+            /// Hash of every entry up to this one
+            std::uint64_t hash;
+            std::int32_t term;
+            /// CRC32C of the entry, see LogEntries::checksum()
+            std::uint32_t crc;
+        };
+
+        /// Hash of an entry following one of hash `previous`, the CRC of the
+        /// entry already covers its term, client, id and payload
+        inline std::uint64_t chain(std::uint64_t previous, std::int32_t term,
+                                   std::uint32_t crc)
+        {
+            // splitmix64 finalizer
+            std::uint64_t x = previous
+                ^ (static_cast<std::uint64_t>(static_cast<std::uint32_t>(term))
+                       << 32
+                   | crc);
+            x += 0x9e3779b97f4a7c15;
+            x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+            x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+            return x ^ (x >> 31);
+        }
+    } // namespace committed_log
+} // namespace utils
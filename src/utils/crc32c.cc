@@ -0,0 +1,173 @@
+#include "utils/crc32c.hh"
+
+#include <array>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#    include <nmmintrin.h>
+#elif defined(__aarch64__)
+#    include <arm_acle.h>
+#    include <sys/auxv.h>
+#endif
+
+namespace utils
+{
+    namespace
+    {
+        using crc32c_function = std::uint32_t (*)(const void*, std::size_t,
+                                                  std::uint32_t);
+
+        /// Reversed Castagnoli polynomial
+        constexpr std::uint32_t polynomial = 0x82f63b78;
+
+        /// Slicing-by-8 tables, table[k][b] is the CRC of byte b followed by
+        /// k zero bytes
+        using tables_type = std::array<std::array<std::uint32_t, 256>, 8>;
+
+        tables_type make_tables()
+        {
+            tables_type tables;
+
+            for (std::uint32_t b = 0; b < 256; b++)
+            {
+                std::uint32_t crc = b;
+                for (int i = 0; i < 8; i++)
+                    crc = (crc >> 1) ^ (crc & 1 ? polynomial : 0);
+                tables[0][b] = crc;
+            }
+
+            for (std::uint32_t b = 0; b < 256; b++)
+                for (int k = 1; k < 8; k++)
+                    tables[k][b] = (tables[k - 1][b] >> 8)
+                        ^ tables[0][tables[k - 1][b] & 0xff];
+
+            return tables;
+        }
+
+        const tables_type tables = make_tables();
+
+        std::uint32_t crc32c_table(const void* data, std::size_t size,
+                                   std::uint32_t crc)
+        {
+            auto bytes = static_cast<const unsigned char*>(data);
+            crc = ~crc;
+
+            while (size >= 8)
+            {
+                std::uint64_t word;
+                std::memcpy(&word, bytes, 8);
+                word ^= crc;
+
+                crc = tables[7][word & 0xff] ^ tables[6][(word >> 8) & 0xff]
+                    ^ tables[5][(word >> 16) & 0xff]
+                    ^ tables[4][(word >> 24) & 0xff]
+                    ^ tables[3][(word >> 32) & 0xff]
+                    ^ tables[2][(word >> 40) & 0xff]
+                    ^ tables[1][(word >> 48) & 0xff] ^ tables[0][word >> 56];
+
+                bytes += 8;
+                size -= 8;
+            }
+
+            while (size--)
+                crc = (crc >> 8) ^ tables[0][(crc ^ *bytes++) & 0xff];
+
+            return ~crc;
+        }
+
+#if defined(__x86_64__)
+        __attribute__((target("sse4.2"))) std::uint32_t
+        crc32c_hardware(const void* data, std::size_t size, std::uint32_t crc)
+        {
+            auto bytes = static_cast<const unsigned char*>(data);
+            std::uint64_t crc64 = ~crc;
+
+            while (size >= 8)
+            {
+                std::uint64_t word;
+                std::memcpy(&word, bytes, 8);
+                crc64 = _mm_crc32_u64(crc64, word);
+
+                bytes += 8;
+                size -= 8;
+            }
+
+            auto crc32 = static_cast<std::uint32_t>(crc64);
+            while (size--)
+                crc32 = _mm_crc32_u8(crc32, *bytes++);
+
+            return ~crc32;
+        }
+
+        bool has_crc_instructions()
+        {
+            return __builtin_cpu_supports("sse4.2");
+        }
+
+        constexpr const char* hardware_name = "sse4.2";
+#elif defined(__aarch64__)
+        __attribute__((target("+crc"))) std::uint32_t
+        crc32c_hardware(const void* data, std::size_t size, std::uint32_t crc)
+        {
+            auto bytes = static_cast<const unsigned char*>(data);
+            crc = ~crc;
+
+            while (size >= 8)
+            {
+                std::uint64_t word;
+                std::memcpy(&word, bytes, 8);
+                crc = __crc32cd(crc, word);
+
+                bytes += 8;
+                size -= 8;
+            }
+
+            while (size--)
+                crc = __crc32cb(crc, *bytes++);
+
+            return ~crc;
+        }
+
+        bool has_crc_instructions()
+        {
+            return getauxval(AT_HWCAP) & HWCAP_CRC32;
+        }
+
+        constexpr const char* hardware_name = "armv8-crc";
+#else
+        std::uint32_t crc32c_hardware(const void* data, std::size_t size,
+                                      std::uint32_t crc)
+        {
+            return crc32c_table(data, size, crc);
+        }
+
+        bool has_crc_instructions()
+        {
+            return false;
+        }
+
+        constexpr const char* hardware_name = "table";
+#endif
+
+        const bool hardware = has_crc_instructions();
+
+        const crc32c_function implementation =
+            hardware ? crc32c_hardware : crc32c_table;
+    } // namespace
+
+    std::uint32_t crc32c(const void* data, std::size_t size, std::uint32_t crc)
+    {
+        return implementation(data, size, crc);
+    }
+
+    std::uint32_t crc32c_portable(const void* data, std::size_t size,
+                                  std::uint32_t crc)
+    {
+        return crc32c_table(data, size, crc);
+    }
+
+    const char* crc32c_implementation()
+    {
+        return hardware ? hardware_name : "table";
+    }
+} // namespace utils
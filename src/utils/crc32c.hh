@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace utils
+{
+    /// CRC32C (Castagnoli) of `size` bytes. Pass the previous result as `crc`
+    /// to checksum data spread over several buffers. Uses the CRC
+    /// instructions of the processor when it has them.
+    std::uint32_t crc32c(const void* data, std::size_t size,
+                         std::uint32_t crc = 0);
+
+    /// Table-driven implementation, used when the processor has no CRC
+    /// instructions
+    std::uint32_t crc32c_portable(const void* data, std::size_t size,
+                                  std::uint32_t crc = 0);
+
+    /// Name of the implementation selected for this processor
+    const char* crc32c_implementation();
+} // namespace utils
@@ -0,0 +1,49 @@
+#include "utils/durable_state.hh"
+
+#include <cstddef>
+
+#include "utils/crc32c.hh"
+
+namespace utils
+{
+    DurableState::DurableState(const std::string& path, bool sync)
+        : file_(path, true)
+        , sync_(sync)
+        , saved_{0, -1, -1, 0}
+    {}
+
+    void DurableState::save(int term, rank voted_for, int commit_index)
+    {
+        if (term == saved_.term && voted_for == saved_.voted_for
+            && commit_index == saved_.commit_index)
+            return;
+
+        // A commit index can be applied again, a vote must not be lost
+        bool vote = term != saved_.term || voted_for != saved_.voted_for;
+
+        saved_ = Record{term, voted_for, commit_index, 0};
+        saved_.crc = checksum(saved_);
+
+        // A record is much smaller than a page, it is never torn by the
+        // crash of the process
+        file_.write_at(&saved_, sizeof(saved_), 0);
+
+        if (sync_ && vote)
+            file_.sync();
+    }
+
+    std::optional<DurableState::Record> DurableState::load() const
+    {
+        Record record;
+
+        if (file_.read_at(&record, sizeof(record), 0) != sizeof(record)
+            || record.crc != checksum(record))
+            return {};
+        return record;
+    }
+
+    std::uint32_t DurableState::checksum(const Record& record)
+    {
+        return crc32c(&record, offsetof(Record, crc));
+    }
+} // namespace utils
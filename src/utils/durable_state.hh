@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+
+#include "common.hh"
+#include "utils/file.hh"
+
+namespace utils
+{
+    /// State of a server in a group which must survive a crash along with
+    /// its log: its term, its vote and the index up to which its log was
+    /// applied. It is rewritten in place as a single checksummed record.
+    class DurableState
+    {
+    public:
+        struct Record
+        {
+            int term;
+            rank voted_for;
+            int commit_index;
+            std::uint32_t crc;
+        };
+
+        /// A new server starts from an empty state, whatever is in `path`.
+        /// Terms and votes are synced to disk if `sync` is set.
+        DurableState(const std::string& path, bool sync);
+
+        /// Write the state, unless it did not change since the last call
+        void save(int term, rank voted_for, int commit_index);
+
+        /// State read back from the disk, nullopt if it was never written or
+        /// is corrupted
+        std::optional<Record> load() const;
+
+    private:
+        static std::uint32_t checksum(const Record& record);
+
+        File file_;
+        bool sync_;
+        Record saved_;
+    };
+} // namespace utils
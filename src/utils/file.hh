@@ -0,0 +1,90 @@
+#pragma once
+
+#include <fcntl.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+namespace utils
+{
+    /// File opened for positioned writes, closed along with the object
+    class File
+    {
+    public:
+        File() = default;
+
+        /// Open `path` for reading and writing, creating it if needed and
+        /// emptying it if `truncate` is set
+        File(const std::string& path, bool truncate)
+            : fd_(open(path.c_str(),
+                       O_RDWR | O_CREAT | (truncate ? O_TRUNC : 0), 0644))
+        {}
+
+        File(File&& other)
+            : fd_(std::exchange(other.fd_, -1))
+        {}
+
+        File& operator=(File&& other)
+        {
+            std::swap(fd_, other.fd_);
+            return *this;
+        }
+
+        File(const File&) = delete;
+        File& operator=(const File&) = delete;
+
+        ~File()
+        {
+            if (fd_ >= 0)
+                close(fd_);
+        }
+
+        inline operator bool() const
+        {
+            return fd_ >= 0;
+        }
+
+        /// Write `size` bytes of `data` at `offset`, return whether all of
+        /// them were written
+        inline bool write_at(const void* data, std::size_t size, off_t offset)
+        {
+            auto bytes = static_cast<const char*>(data);
+
+            while (size)
+            {
+                auto written = pwrite(fd_, bytes, size, offset);
+                if (written <= 0)
+                    return false;
+
+                bytes += written;
+                size -= written;
+                offset += written;
+            }
+
+            return true;
+        }
+
+        /// Read up to `size` bytes at `offset`, return how many were read
+        inline std::size_t read_at(void* data, std::size_t size,
+                                   off_t offset) const
+        {
+            auto read = pread(fd_, data, size, offset);
+            return read < 0 ? 0 : read;
+        }
+
+        inline bool truncate(off_t size)
+        {
+            return !ftruncate(fd_, size);
+        }
+
+        /// Wait for the data written so far to reach the disk
+        inline bool sync()
+        {
+            return !fdatasync(fd_);
+        }
+
+    private:
+        int fd_ = -1;
+    };
+} // namespace utils
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <vector>
+
+namespace utils
+{
+    /// Histogram of durations in the manner of HdrHistogram: values in
+    /// nanoseconds are bucketed by power of two, each power being split in
+    /// `sub_buckets / 2` linear buckets, which bounds the relative error by
+    /// 2 / sub_buckets. Recording only computes an index and increments a
+    /// counter, servers are single threaded so no synchronization is needed.
+    /// Histograms of several servers are merged by adding their counts.
+    class Histogram
+    {
+    public:
+        static constexpr int sub_bucket_bits = 7;
+        static constexpr std::uint64_t sub_buckets = 1 << sub_bucket_bits;
+
+        /// Longer durations, about 18 minutes, are counted as this one
+        static constexpr std::uint64_t max_value = (std::uint64_t{1} << 40) - 1;
+
+        Histogram()
+            : counts_(index(max_value) + 1)
+        {}
+
+        /// Record a duration in seconds
+        inline void record(double seconds)
+        {
+            auto value = static_cast<std::uint64_t>(
+                std::clamp(seconds * 1e9, 0., static_cast<double>(max_value)));
+
+            counts_[index(value)]++;
+            count_++;
+            sum_ += value;
+            max_ = std::max(max_, value);
+        }
+
+        inline void merge(const Histogram& other)
+        {
+            for (std::size_t i = 0; i < counts_.size(); i++)
+                counts_[i] += other.counts_[i];
+
+            count_ += other.count_;
+            sum_ += other.sum_;
+            max_ = std::max(max_, other.max_);
+        }
+
+        inline std::uint64_t count() const
+        {
+            return count_;
+        }
+
+        /// Mean and largest recorded values, in seconds
+        inline double mean() const
+        {
+            return count_ ? sum_ / count_ * 1e-9 : 0;
+        }
+
+        inline double max() const
+        {
+            return max_ * 1e-9;
+        }
+
+        /// Upper bound of the bucket holding the `p` percentile, in seconds
+        inline double percentile(double p) const
+        {
+            if (!count_)
+                return 0;
+
+            auto rank = static_cast<std::uint64_t>(p / 100 * count_ + 0.5);
+            rank = std::clamp<std::uint64_t>(rank, 1, count_);
+
+            std::uint64_t seen = 0;
+            for (std::size_t i = 0; i < counts_.size(); i++)
+            {
+                seen += counts_[i];
+                if (seen >= rank)
+                    return std::min(upper_bound(i) - 1, max_) * 1e-9;
+            }
+
+            return 0;
+        }
+
+        /// Call `f(lower, upper, count)` on every non-empty bucket, bounds in
+        /// nanoseconds, the upper one excluded
+        template <typename F>
+        inline void for_each_bucket(F f) const
+        {
+            for (std::size_t i = 0; i < counts_.size(); i++)
+                if (counts_[i])
+                    f(lower_bound(i), upper_bound(i), counts_[i]);
+        }
+
+    private:
+        static constexpr std::uint64_t half = sub_buckets / 2;
+
+        /// Values below `sub_buckets` have their own bucket, the following
+        /// powers of two are split in `half` buckets each
+        static inline std::size_t index(std::uint64_t value)
+        {
+            if (value < sub_buckets)
+                return value;
+
+            int shift = std::bit_width(value) - sub_bucket_bits;
+            return (shift + 1) * half + ((value >> shift) - half);
+        }
+
+        static inline std::uint64_t lower_bound(std::size_t index)
+        {
+            if (index < sub_buckets)
+                return index;
+
+            int shift = index / half - 1;
+            return (index % half + half) << shift;
+        }
+
+        static inline std::uint64_t upper_bound(std::size_t index)
+        {
+            if (index < sub_buckets)
+                return index + 1;
+
+            int shift = index / half - 1;
+            return (index % half + half + 1) << shift;
+        }
+
+        std::vector<std::uint64_t> counts_;
+        std::uint64_t count_ = 0;
+        double sum_ = 0;
+        std::uint64_t max_ = 0;
+    };
+} // namespace utils
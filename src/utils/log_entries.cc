@@ -1,78 +1,599 @@
 #include "utils/log_entries.hh"
 
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
 
+#include "utils/committed_log.hh"
+#include "utils/crc32c.hh"
+
 #define LOG(mode) logger_ << Logger::LogType::mode
 
 namespace utils
 {
-    LogEntries::LogEntries(std::string file)
-        : entries_()
-        , commit_index_(-1)
-        , logger_(file)
+    // Enough room for the largest payload of every entry, a segment is only
+    // full once all its headers are used
+    static constexpr std::uint32_t arena_size =
+        LogEntries::segment_size * sizeof(rpc::command_t);
+
+    static constexpr std::size_t headers_size =
+        LogEntries::segment_size * sizeof(LogEntries::Header);
+
+    // Dropped segments kept around, enough to absorb a truncation followed
+    // by appends without reallocating
+    static constexpr std::size_t max_spare_segments = 2;
+
+    LogEntries::Segment::Segment()
+        : headers()
+        , arena(new char[arena_size])
+        , arena_used(0)
+        , sealed()
+        , file()
+    {
+        headers.reserve(segment_size);
+    }
+
+    LogEntries::Segment::Segment(MappedFile file)
+        : headers()
+        , arena()
+        , arena_used(0)
+        , sealed(file ? std::make_shared<const MappedFile>(std::move(file))
+                      : nullptr)
+        , file()
     {}
 
-    void LogEntries::append_entry(int term, rpc::ClientRequest data)
+    std::size_t LogEntries::Segment::size() const
+    {
+        return sealed ? segment_size : headers.size();
+    }
+
+    const LogEntries::Header* LogEntries::Segment::header_data() const
+    {
+        if (sealed)
+            return reinterpret_cast<const Header*>(sealed->data());
+        return headers.data();
+    }
+
+    const char* LogEntries::Segment::payload() const
+    {
+        if (sealed)
+            return sealed->data() + headers_size;
+        return arena.get();
+    }
+
+    LogEntries::LogEntries(std::string file, bool sync)
+        : segments_()
+        , spare_segments_()
+        , first_index_(0)
+        , nb_entries_(0)
+        , commit_index_(-1)
+        , uncommitted_bytes_(0)
+        , writer_(std::make_unique<LogWriter>(sync))
+        , pending_()
+        , durable_index_(-1)
+        , write_failures_(0)
+        , to_seal_()
+        , segment_prefix_(file.substr(0, file.rfind(".log")))
+        , logger_(file)
+        , committed_()
+        , committed_hash_(0)
     {
-        for (const auto& entry : entries_)
+        // Segments left by a previous run would be read back by reload()
+        std::filesystem::path prefix(segment_prefix_);
+        auto directory = prefix.parent_path();
+        auto name = prefix.filename().string() + "_segment";
+
+        std::error_code error;
+        for (const auto& entry : std::filesystem::directory_iterator(
+                 directory.empty() ? "." : directory, error))
         {
-            // if entry already in the log do not add it again
-            if (entry.data == data)
-                return;
+            auto file = entry.path().filename().string();
+            if (file.starts_with(name) && file.ends_with(".bin"))
+                std::filesystem::remove(entry.path(), error);
         }
+    }
 
-        entries_.emplace_back(Entry{term, data});
+    void LogEntries::append_entry(int term, rpc::ClientRequest data)
+    {
+        auto length = data.command.size();
+
+        Header header{term,    0, data.source, data.group,
+                      data.id, 0, static_cast<std::uint32_t>(length), 0};
+        header.crc = checksum(header, data.command.data());
+
+        push_entry(header, data.command.data());
     }
 
-    int LogEntries::last_log_index() const
+    void LogEntries::append_entry(const Header& header, const char* payload)
+    {
+        push_entry(header, payload);
+    }
+
+    std::uint32_t LogEntries::checksum(const Header& header,
+                                       const char* payload)
     {
-        int size = entries_.size();
+        std::int32_t fields[] = {header.term, header.client, header.group,
+                                 static_cast<std::int32_t>(header.id)};
 
-        if (size)
-            return size - 1;
-        return -1;
+        return crc32c(payload, header.length, crc32c(fields, sizeof(fields)));
+    }
+
+    bool LogEntries::verify(const Header& header, const char* payload)
+    {
+        return header.length <= sizeof(rpc::command_t)
+            && header.crc == checksum(header, payload);
+    }
+
+    int LogEntries::last_log_index() const
+    {
+        return first_index_ + nb_entries_ - 1;
     }
 
     int LogEntries::last_log_term() const
     {
-        if (entries_.size())
-            return entries_.back().term;
+        if (nb_entries_)
+            return header(last_log_index()).term;
         return -1;
     }
 
+    int LogEntries::durable_index()
+    {
+        writer_->submit();
+
+        auto done = writer_->done();
+
+        while (!pending_.empty() && pending_.front().first <= done)
+        {
+            durable_index_ = pending_.front().second;
+            pending_.pop_front();
+        }
+
+        // The entry stays in memory, as when it was written synchronously
+        if (writer_->failures() != write_failures_)
+        {
+            write_failures_ = writer_->failures();
+            LOG(ERROR) << "cannot write entries up to " << durable_index_
+                       << " to disk";
+        }
+
+        seal_durable();
+
+        return durable_index_;
+    }
+
+    void LogEntries::wait_durable(int index)
+    {
+        // Last write of the last pending entry up to `index`
+        auto last = std::find_if(
+            pending_.rbegin(), pending_.rend(),
+            [&](const auto& entry) { return entry.second <= index; });
+
+        if (last != pending_.rend())
+            writer_->wait(last->first);
+
+        durable_index();
+    }
+
     int LogEntries::get_commit_index() const
     {
         return commit_index_;
     }
 
+    std::size_t LogEntries::uncommitted_bytes() const
+    {
+        return uncommitted_bytes_;
+    }
+
     bool LogEntries::commit_next_entry()
     {
         if (commit_index_ >= last_log_index())
             return false;
 
         commit_index_++;
+        uncommitted_bytes_ -= header(commit_index_).length;
 
-        const auto entry = entries_[commit_index_];
-        LOG(INFO) << "term: " << entry.term << ", client: " << entry.data.source
-                  << ", command: " << entry.data.command << ", id "
-                  << entry.data.id;
+        const auto entry = (*this)[commit_index_];
+        if (!rpc::internal_entry(entry.data.source))
+            LOG(INFO) << "term: " << entry.term
+                      << ", client: " << entry.data.source
+                      << ", command: " << entry.data.command << ", id "
+                      << entry.data.id;
+
+        if (committed_.is_open())
+        {
+            const auto& committed = header(commit_index_);
+            committed_hash_ = committed_log::chain(
+                committed_hash_, committed.term, committed.crc);
+
+            committed_log::Record record{committed_hash_, committed.term,
+                                         committed.crc};
+            committed_.write(reinterpret_cast<const char*>(&record),
+                             sizeof(record));
+        }
+
+        // Last entry of its segment, which can no longer change. It is sealed
+        // once its writes are done, without waiting for them here.
+        auto position = commit_index_ - first_index_;
+        if (position % segment_size == segment_size - 1)
+        {
+            to_seal_.push_back(commit_index_ - segment_size + 1);
+            seal_durable();
+        }
 
         return true;
     }
 
     size_t LogEntries::size() const
     {
-        return entries_.size();
+        return last_log_index() + 1;
     }
 
     void LogEntries::delete_from_index(unsigned index)
     {
-        if (index < entries_.size())
-            entries_.resize(index);
+        int from = std::max<int>(index, first_index_);
+
+        if (from > last_log_index())
+            return;
+
+        // Truncated entries are cleared on disk, after their queued writes
+        writer_->flush();
+        durable_index();
+
+        pending_.clear();
+        durable_index_ = std::min(durable_index_, from - 1);
+
+        uncommitted_bytes_ -= payload_bytes(std::max(from, commit_index_ + 1));
+
+        // Whole segments are dropped, the one holding `from` is cut
+        auto position = from - first_index_;
+        std::size_t kept_segments = position / segment_size + 1;
+
+        while (segments_.size() > kept_segments)
+        {
+            int first = first_index_ + (segments_.size() - 1) * segment_size;
+            release_segment(std::move(segments_.back()));
+            segments_.pop_back();
+            std::remove(segment_path(first).c_str());
+        }
+
+        auto& segment = segments_.back();
+        int first = first_index_ + (kept_segments - 1) * segment_size;
+        std::size_t kept_headers = position % segment_size;
+
+        if (segment.sealed)
+            unseal(segment, first);
+
+        // Truncated headers are cleared on disk as well, so that reload()
+        // stops before them
+        auto removed = segment.headers.size() - kept_headers;
+        std::vector<Header> cleared(removed);
+        segment.file->write_at(cleared.data(), removed * sizeof(Header),
+                               kept_headers * sizeof(Header));
+
+        if (kept_headers < segment.headers.size())
+            segment.arena_used = segment.headers[kept_headers].offset;
+        segment.headers.resize(kept_headers);
+
+        nb_entries_ = position;
+
+        if (segment.headers.empty())
+        {
+            release_segment(std::move(segments_.back()));
+            segments_.pop_back();
+            std::remove(segment_path(first).c_str());
+        }
+    }
+
+    int LogEntries::first_log_index() const
+    {
+        return first_index_;
+    }
+
+    int LogEntries::term(int i) const
+    {
+        return header(i).term;
+    }
+
+    LogEntries::Entry LogEntries::operator[](int i) const
+    {
+        const auto& segment = segments_[(i - first_index_) / segment_size];
+        const auto& header = this->header(i);
+
+        rpc::ClientRequest data{
+            header.client, header.group, header.id,
+            rpc::command_t(segment.payload() + header.offset, header.length)};
+
+        return Entry{header.term, data};
     }
 
-    LogEntries::Entry& LogEntries::operator[](int i)
+    std::optional<LogEntries::Range>
+    LogEntries::range(int index, std::size_t max_entries) const
     {
-        return entries_[i];
+        if (index < first_index_ || index > last_log_index() || !max_entries)
+            return {};
+
+        auto position = index - first_index_;
+        const auto& segment = segments_[position / segment_size];
+
+        std::size_t first = position % segment_size;
+        std::size_t last = std::min(segment.size(), first + max_entries);
+
+        const auto* headers = segment.header_data();
+        auto payload_begin = headers[first].offset;
+        auto payload_end = headers[last - 1].offset + headers[last - 1].length;
+
+        return Range{headers + first,
+                     last - first,
+                     segment.payload() + payload_begin,
+                     payload_end - payload_begin,
+                     segment.sealed};
+    }
+
+    std::optional<LogEntries::Range>
+    LogEntries::sealed_range(int index, std::size_t max_entries) const
+    {
+        auto range = this->range(index, max_entries);
+
+        if (!range || !range->sealed)
+            return {};
+        return range;
+    }
+
+    std::vector<LogEntries::SegmentStats> LogEntries::memory() const
+    {
+        std::vector<SegmentStats> stats;
+        int first_index = first_index_;
+
+        for (const auto& segment : segments_)
+        {
+            if (segment.sealed)
+                stats.push_back(SegmentStats{first_index, segment_size,
+                                             headers_size,
+                                             segment.sealed->size()
+                                                 - headers_size,
+                                             0, true});
+            else
+                stats.push_back(
+                    SegmentStats{first_index, segment.headers.size(),
+                                 segment.headers.size() * sizeof(Header),
+                                 segment.arena_used,
+                                 headers_size + arena_size, false});
+
+            first_index += segment_size;
+        }
+
+        return stats;
+    }
+
+    void LogEntries::reload(int commit_index)
+    {
+        writer_->flush();
+        pending_.clear();
+        to_seal_.clear();
+
+        while (!segments_.empty())
+        {
+            release_segment(std::move(segments_.back()));
+            segments_.pop_back();
+        }
+        nb_entries_ = 0;
+
+        for (int first = first_index_;; first += segment_size)
+        {
+            auto path = segment_path(first);
+            MappedFile file(path);
+            if (!file)
+                break;
+
+            const auto* headers = reinterpret_cast<const Header*>(file.data());
+            const auto* payload = file.data() + headers_size;
+            auto available = std::min<std::size_t>(
+                segment_size, file.size() / sizeof(Header));
+
+            // Cleared or partially written entries end the log
+            std::size_t count = 0;
+            for (; count < available; count++)
+            {
+                const auto& header = headers[count];
+
+                if (header.index != first + static_cast<int>(count)
+                    || (header.length
+                        && headers_size + header.offset + header.length
+                            > file.size())
+                    || !verify(header, payload + header.offset))
+                    break;
+            }
+
+            if (!count)
+                break;
+
+            // Commited segments were sealed, the others go back to memory
+            if (count == segment_size
+                && first + segment_size - 1 <= commit_index)
+                segments_.emplace_back(std::move(file));
+            else
+            {
+                auto segment = new_segment();
+                segment.headers.assign(headers, headers + count);
+
+                const auto& last = headers[count - 1];
+                segment.arena_used = last.offset + last.length;
+                std::memcpy(segment.arena.get(), payload, segment.arena_used);
+
+                segment.file = std::make_shared<File>(path, false);
+                segments_.push_back(std::move(segment));
+            }
+
+            nb_entries_ += count;
+
+            if (count < segment_size)
+                break;
+        }
+
+        commit_index_ = std::min(commit_index, last_log_index());
+        durable_index_ = last_log_index();
+        uncommitted_bytes_ = payload_bytes(commit_index_ + 1);
+    }
+
+    void LogEntries::export_committed(const std::string& path)
+    {
+        committed_.open(path, std::ios::binary | std::ios::trunc);
+        committed_.write(committed_log::magic.data(),
+                         committed_log::magic.size());
+    }
+
+    const LogEntries::Header& LogEntries::header(int i) const
+    {
+        auto position = i - first_index_;
+        return segments_[position / segment_size]
+            .header_data()[position % segment_size];
+    }
+
+    std::string LogEntries::segment_path(int first_index) const
+    {
+        return segment_prefix_ + "_segment" + std::to_string(first_index)
+            + ".bin";
+    }
+
+    LogEntries::Segment LogEntries::new_segment()
+    {
+        if (spare_segments_.empty())
+            return Segment();
+
+        auto segment = std::move(spare_segments_.back());
+        spare_segments_.pop_back();
+
+        segment.headers.clear();
+        segment.arena_used = 0;
+
+        return segment;
+    }
+
+    void LogEntries::release_segment(Segment segment)
+    {
+        segment.file.reset();
+
+        // Only segments with buffers are worth keeping
+        if (!segment.sealed && spare_segments_.size() < max_spare_segments)
+            spare_segments_.push_back(std::move(segment));
+    }
+
+    void LogEntries::seal_durable()
+    {
+        while (!to_seal_.empty()
+               && to_seal_.front() + segment_size - 1 <= durable_index_)
+        {
+            auto first = to_seal_.front();
+            to_seal_.pop_front();
+            seal(segments_[(first - first_index_) / segment_size], first);
+        }
+    }
+
+    void LogEntries::seal(Segment& segment, int first_index)
+    {
+        auto path = segment_path(first_index);
+
+        // Entries are in the file once their writes are done, without the
+        // payloads of truncated ones past the end of the arena
+        if (!segment.file->truncate(headers_size + segment.arena_used))
+            return;
+
+        Segment sealed(MappedFile{path});
+
+        // Keep the segment in memory if it could not be mapped
+        if (!sealed.sealed)
+            return;
+
+        // Check what is read back from the disk
+        for (int i = 0; i < segment_size; i++)
+        {
+            const auto& header = sealed.header_data()[i];
+
+            if (!verify(header, sealed.payload() + header.offset))
+            {
+                LOG(ERROR) << "corrupted entry " << first_index + i << " in "
+                           << path << ", segment kept in memory";
+                return;
+            }
+        }
+
+        release_segment(std::move(segment));
+        segment = std::move(sealed);
+    }
+
+    void LogEntries::unseal(Segment& segment, int first_index)
+    {
+        auto copy = new_segment();
+        copy.file = std::make_shared<File>(segment_path(first_index), false);
+
+        const auto* headers = segment.header_data();
+        copy.headers.assign(headers, headers + segment_size);
+
+        auto payload_size = segment.sealed->size() - headers_size;
+        std::memcpy(copy.arena.get(), segment.payload(), payload_size);
+        copy.arena_used = payload_size;
+
+        segment = std::move(copy);
+    }
+
+    std::size_t LogEntries::payload_bytes(int index) const
+    {
+        if (index > last_log_index())
+            return 0;
+
+        // Payloads are contiguous in each segment, in the order of the
+        // entries
+        auto position = index - first_index_;
+        std::size_t first = position / segment_size;
+        std::size_t bytes = 0;
+
+        for (auto i = first; i < segments_.size(); i++)
+        {
+            const auto& segment = segments_[i];
+            const auto* headers = segment.header_data();
+            const auto& last = headers[segment.size() - 1];
+
+            bytes += last.offset + last.length;
+            if (i == first)
+                bytes -= headers[position % segment_size].offset;
+        }
+
+        return bytes;
+    }
+
+    void LogEntries::push_entry(Header header, const char* payload)
+    {
+        if (segments_.empty() || segments_.back().size() == segment_size)
+        {
+            segments_.push_back(new_segment());
+            segments_.back().file = std::make_shared<File>(
+                segment_path(first_index_ + nb_entries_), true);
+        }
+
+        auto& segment = segments_.back();
+
+        header.index = first_index_ + nb_entries_;
+        header.offset = segment.arena_used;
+
+        std::memcpy(segment.arena.get() + segment.arena_used, payload,
+                    header.length);
+        segment.arena_used += header.length;
+
+        // The payload is written first, a header on disk is always complete
+        auto position = segment.headers.size();
+        if (header.length)
+            writer_->write(segment.file, payload, header.length,
+                           headers_size + header.offset);
+
+        auto sequence = writer_->write(segment.file, &header, sizeof(header),
+                                       position * sizeof(header));
+        pending_.emplace_back(sequence, header.index);
+
+        segment.headers.push_back(header);
+        nb_entries_++;
+        uncommitted_bytes_ += header.length;
     }
 } // namespace utils
@@ -1,12 +1,27 @@
 #pragma once
 
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <optional>
 #include <vector>
 
 #include "rpc/rpc.hh"
+#include "utils/file.hh"
+#include "utils/log_writer.hh"
 #include "utils/logger.hh"
+#include "utils/mapped_file.hh"
 
 namespace utils
 {
+    /// Log stored as a ring of fixed-size segments. Each segment keeps the
+    /// fixed-size headers of its entries apart from their payloads, which are
+    /// bump allocated in an arena owned by the segment. Entries are written
+    /// to the file of their segment by a LogWriter as they are appended, with
+    /// the same layout, so that the log can be reloaded after a crash. Once
+    /// all its entries are commited and written, a segment is sealed: its
+    /// file is mapped back read-only in place of its buffers.
     class LogEntries
     {
     public:
@@ -16,24 +31,201 @@ namespace utils
             rpc::ClientRequest data;
         };
 
-        LogEntries(std::string file);
+        struct Header
+        {
+            int term;
+            int index;
+            rank client;
+            int group;
+            unsigned id;
+            /// Position of the payload in the segment
+            std::uint32_t offset;
+            std::uint32_t length;
+            /// CRC32C of the entry, see checksum()
+            std::uint32_t crc;
+        };
+
+        /// Contiguous entries of a segment, sealed ones are sent without
+        /// copy
+        struct Range
+        {
+            const Header* headers;
+            std::size_t nb_entries;
+            const char* payload;
+            std::size_t payload_size;
+            /// Mapping of a sealed segment, which outlives the segment as long
+            /// as it is shared, null otherwise
+            std::shared_ptr<const MappedFile> sealed;
+        };
+
+        /// Memory used by a segment, in bytes
+        struct SegmentStats
+        {
+            int first_index;
+            std::size_t nb_entries;
+            std::size_t header_bytes;
+            std::size_t payload_bytes;
+            /// Heap memory of the segment, none once sealed
+            std::size_t capacity_bytes;
+            bool sealed;
+        };
+
+        /// Number of entries per segment
+        static constexpr int segment_size = 1024;
+
+        /// Checksum of the term, client, group, id and payload of an entry,
+        /// the same on every server
+        static std::uint32_t checksum(const Header& header,
+                                      const char* payload);
+
+        static bool verify(const Header& header, const char* payload);
+
+        /// Segment files of a previous log of the same name are removed.
+        /// Appended entries are synced to disk if `sync` is set.
+        LogEntries(std::string file, bool sync = false);
 
+        /// Append `data` as is, duplicates of retried requests are filtered
+        /// out by the leader
         void append_entry(int term, rpc::ClientRequest data);
 
+        /// Append an entry replicated from the leader, its payload starts at
+        /// `payload` and its checksum was verified
+        void append_entry(const Header& header, const char* payload);
+
         int last_log_index() const;
         int last_log_term() const;
 
+        /// Last index up to which every entry is on disk, synced if enabled.
+        /// The writes of the entries appended since the last call are
+        /// started.
+        int durable_index();
+
+        /// Wait until the entries up to `index` are on disk
+        void wait_durable(int index);
+
         int get_commit_index() const;
+        /// Payload bytes of the entries after the commit index
+        std::size_t uncommitted_bytes() const;
         bool commit_next_entry();
         size_t size() const;
+
+        /// Truncate the log from `index`, in constant time per segment
         void delete_from_index(unsigned index);
 
-        Entry& operator[](int i);
+        /// Index of the first entry still stored
+        int first_log_index() const;
+
+        /// Term of entry `i`, without copying its payload
+        int term(int i) const;
+
+        /// Header of entry `i`, without copying its payload
+        const Header& header(int i) const;
+
+        Entry operator[](int i) const;
+
+        /// Up to `max_entries` entries from `index`, up to the end of its
+        /// segment
+        std::optional<Range> range(int index, std::size_t max_entries) const;
+
+        /// Same as range(), if `index` is in a sealed segment
+        std::optional<Range> sealed_range(int index,
+                                          std::size_t max_entries) const;
+
+        std::vector<SegmentStats> memory() const;
+
+        /// Read the log back from its segment files, as after a crash, up to
+        /// the first entry which was not fully written. Entries up to
+        /// `commit_index` were already commited and are not logged again.
+        void reload(int commit_index);
+
+        /// Write every commited entry to `path`, in the format of
+        /// utils::committed_log, before anything is commited
+        void export_committed(const std::string& path);
 
     private:
-        std::vector<Entry> entries_;
+        struct Segment
+        {
+            Segment();
+            Segment(MappedFile file);
+
+            std::size_t size() const;
+            const Header* header_data() const;
+            const char* payload() const;
+
+            /// Headers of the entries, never reallocated
+            std::vector<Header> headers;
+
+            /// Payload arena and its bump pointer
+            std::unique_ptr<char[]> arena;
+            std::uint32_t arena_used;
+
+            /// Headers then payloads, once sealed. It is shared with the sends
+            /// still reading it.
+            std::shared_ptr<const MappedFile> sealed;
+
+            /// File the entries are written to, until sealed. It is shared
+            /// with the writes still queued.
+            std::shared_ptr<File> file;
+        };
+
+        /// `<prefix>_segment<first_index>.bin`
+        std::string segment_path(int first_index) const;
+
+        /// Get an empty segment, reusing a dropped one if possible
+        Segment new_segment();
+        void release_segment(Segment segment);
+
+        /// Seal the commited segments whose entries are all written
+        void seal_durable();
+
+        /// Map a full segment back from its file, once its writes are done
+        void seal(Segment& segment, int first_index);
+
+        /// Copy a sealed segment back to memory so that it can be truncated
+        void unseal(Segment& segment, int first_index);
+
+        /// Payload bytes of the entries from `index` to the end of the log,
+        /// in constant time per segment
+        std::size_t payload_bytes(int index) const;
+
+        /// Append the payload of `header` to the last segment
+        void push_entry(Header header, const char* payload);
+
+        std::deque<Segment> segments_;
+
+        /// Dropped segments kept to avoid reallocating their buffers
+        std::vector<Segment> spare_segments_;
+
+        /// Index of the first entry of the first segment
+        int first_index_;
+
+        /// Number of entries stored
+        int nb_entries_;
+
         int commit_index_;
 
+        /// Payload bytes of the entries after the commit index
+        std::size_t uncommitted_bytes_;
+
+        /// Writes of the appended entries, with the sequence of the last
+        /// write of each entry which is not on disk yet
+        std::unique_ptr<LogWriter> writer_;
+        std::deque<std::pair<LogWriter::sequence, int>> pending_;
+        int durable_index_;
+        std::size_t write_failures_;
+
+        /// First index of the commited segments waiting for their writes to
+        /// be sealed
+        std::deque<int> to_seal_;
+
+        /// Segments are written to `<prefix>_segment<index>.bin`
+        std::string segment_prefix_;
+
         Logger logger_;
+
+        /// Binary export of the commited entries and the hash of the last
+        /// one, when enabled
+        std::ofstream committed_;
+        std::uint64_t committed_hash_;
     };
 } // namespace utils
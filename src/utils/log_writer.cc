@@ -0,0 +1,162 @@
+#include "utils/log_writer.hh"
+
+#include <algorithm>
+#include <utility>
+
+namespace utils
+{
+    LogWriter::LogWriter(bool sync)
+        : sync_(sync)
+        , mutex_()
+        , queued_()
+        , written_()
+        , jobs_()
+        , bytes_()
+        , queued_count_(0)
+        , idle_(false)
+        , stop_(false)
+        , done_(0)
+        , failures_(0)
+        , rounds_(0)
+        , thread_(&LogWriter::run, this)
+    {}
+
+    LogWriter::~LogWriter()
+    {
+        {
+            std::lock_guard lock(mutex_);
+            stop_ = true;
+        }
+
+        queued_.notify_one();
+        thread_.join();
+    }
+
+    LogWriter::sequence LogWriter::write(std::shared_ptr<File> file,
+                                         const void* data, std::size_t size,
+                                         off_t offset)
+    {
+        std::lock_guard lock(mutex_);
+
+        auto begin = bytes_.size();
+        auto bytes = static_cast<const char*>(data);
+        bytes_.insert(bytes_.end(), bytes, bytes + size);
+
+        jobs_.push_back(Job{std::move(file), begin, size, offset});
+        return ++queued_count_;
+    }
+
+    void LogWriter::submit()
+    {
+        bool idle;
+        {
+            std::lock_guard lock(mutex_);
+            idle = !jobs_.empty() && std::exchange(idle_, false);
+        }
+
+        // A busy thread takes the writes in its next round, without a system
+        // call to wake it up
+        if (idle)
+            queued_.notify_one();
+    }
+
+    LogWriter::sequence LogWriter::done() const
+    {
+        return done_.load(std::memory_order_acquire);
+    }
+
+    void LogWriter::wait(sequence until)
+    {
+        if (done() >= until)
+            return;
+
+        submit();
+
+        std::unique_lock lock(mutex_);
+        written_.wait(lock, [&] { return done() >= until; });
+    }
+
+    void LogWriter::flush()
+    {
+        sequence until;
+        {
+            std::lock_guard lock(mutex_);
+            until = queued_count_;
+        }
+
+        wait(until);
+    }
+
+    std::size_t LogWriter::failures() const
+    {
+        return failures_.load(std::memory_order_relaxed);
+    }
+
+    std::size_t LogWriter::rounds() const
+    {
+        return rounds_.load(std::memory_order_relaxed);
+    }
+
+    void LogWriter::run()
+    {
+        // Swapped with the queued ones, their capacity is kept across rounds
+        std::vector<Job> jobs;
+        std::vector<char> bytes;
+
+        while (true)
+        {
+            {
+                std::unique_lock lock(mutex_);
+
+                if (jobs_.empty() && !stop_)
+                {
+                    idle_ = true;
+                    queued_.wait(lock,
+                                 [&] { return stop_ || !jobs_.empty(); });
+                }
+
+                if (jobs_.empty())
+                    return;
+
+                std::swap(jobs, jobs_);
+                std::swap(bytes, bytes_);
+            }
+
+            // Files are synced once, after all their writes of the round
+            std::vector<File*> files;
+
+            for (auto& job : jobs)
+            {
+                if (!job.file->write_at(bytes.data() + job.begin, job.size,
+                                        job.offset))
+                    failures_.fetch_add(1, std::memory_order_relaxed);
+
+                if (files.empty() || files.back() != job.file.get())
+                    files.push_back(job.file.get());
+            }
+
+            if (sync_)
+            {
+                std::sort(files.begin(), files.end());
+                files.erase(std::unique(files.begin(), files.end()),
+                            files.end());
+
+                for (auto* file : files)
+                    if (!file->sync())
+                        failures_.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            rounds_.fetch_add(1, std::memory_order_relaxed);
+
+            {
+                // Published under the lock, so that a waiter cannot miss it
+                std::lock_guard lock(mutex_);
+                done_.fetch_add(jobs.size(), std::memory_order_release);
+            }
+            written_.notify_all();
+
+            jobs.clear();
+            bytes.clear();
+        }
+    }
+} // namespace utils
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "utils/file.hh"
+
+namespace utils
+{
+    /// Thread writing the entries of a log to disk in the background, in the
+    /// order they were queued. Writes are queued without waking it up, then
+    /// submitted together; the ones queued while it is busy are done in its
+    /// next round and synced once, so the cost of a sync is shared by every
+    /// entry appended during the previous one.
+    class LogWriter
+    {
+    public:
+        /// Number of writes queued so far, the sequence number of the last
+        /// one
+        using sequence = std::uint64_t;
+
+        /// Sync the files after each round of writes if `sync` is set
+        LogWriter(bool sync);
+
+        /// Complete every queued write
+        ~LogWriter();
+
+        LogWriter(const LogWriter&) = delete;
+        LogWriter& operator=(const LogWriter&) = delete;
+
+        /// Queue the write of `size` bytes of `data` at `offset` of `file`,
+        /// they are copied to a buffer reused across rounds
+        sequence write(std::shared_ptr<File> file, const void* data,
+                       std::size_t size, off_t offset);
+
+        /// Start the queued writes if the thread is idle
+        void submit();
+
+        /// Sequence number of the last write done, and synced if enabled
+        sequence done() const;
+
+        /// Submit the queued writes and wait until the write `until` is done
+        void wait(sequence until);
+
+        /// Wait until every queued write is done
+        void flush();
+
+        /// Number of writes which failed, the entry is only in memory
+        std::size_t failures() const;
+
+        /// Number of rounds of writes, one sync each if enabled
+        std::size_t rounds() const;
+
+    private:
+        /// Write of `size` bytes from `begin` in the buffer of its round
+        struct Job
+        {
+            std::shared_ptr<File> file;
+            std::size_t begin;
+            std::size_t size;
+            off_t offset;
+        };
+
+        void run();
+
+        bool sync_;
+
+        std::mutex mutex_;
+        std::condition_variable queued_;
+        std::condition_variable written_;
+        std::vector<Job> jobs_;
+        std::vector<char> bytes_;
+        sequence queued_count_;
+        /// Whether the thread waits for writes, it is only woken up then
+        bool idle_;
+        bool stop_;
+
+        std::atomic<sequence> done_;
+        std::atomic<std::size_t> failures_;
+        std::atomic<std::size_t> rounds_;
+
+        /// Started last, once everything it uses is initialized
+        std::thread thread_;
+    };
+} // namespace utils
@@ -0,0 +1,206 @@
+#include "utils/lz4.hh"
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+
+namespace utils
+{
+    namespace
+    {
+        constexpr std::size_t min_match = 4;
+
+        /// The last bytes of a block are always literals, and no match
+        /// starts in the last `match_limit` bytes
+        constexpr std::size_t last_literals = 5;
+        constexpr std::size_t match_limit = 12;
+
+        constexpr std::size_t max_offset = 65535;
+
+        constexpr int hash_log = 12;
+
+        inline std::uint32_t read32(const char* p)
+        {
+            std::uint32_t value;
+            std::memcpy(&value, p, sizeof(value));
+            return value;
+        }
+
+        inline std::uint32_t hash(std::uint32_t sequence)
+        {
+            return (sequence * 2654435761u) >> (32 - hash_log);
+        }
+
+        /// Lengths above 15 are continued by bytes of 255, ending with the
+        /// remainder
+        inline void write_length(char*& out, std::size_t length)
+        {
+            while (length >= 255)
+            {
+                *out++ = static_cast<char>(255);
+                length -= 255;
+            }
+            *out++ = static_cast<char>(length);
+        }
+
+        inline void write_sequence(char*& out, const char* literals,
+                                   std::size_t nb_literals,
+                                   std::size_t match_length,
+                                   std::size_t offset)
+        {
+            char* token = out++;
+
+            auto literal_code = std::min<std::size_t>(nb_literals, 15);
+            if (nb_literals >= 15)
+                write_length(out, nb_literals - 15);
+
+            std::memcpy(out, literals, nb_literals);
+            out += nb_literals;
+
+            // The last sequence only holds literals
+            if (!match_length)
+            {
+                *token = static_cast<char>(literal_code << 4);
+                return;
+            }
+
+            *out++ = static_cast<char>(offset & 0xff);
+            *out++ = static_cast<char>(offset >> 8);
+
+            auto match_code =
+                std::min<std::size_t>(match_length - min_match, 15);
+            if (match_length - min_match >= 15)
+                write_length(out, match_length - min_match - 15);
+
+            *token = static_cast<char>(literal_code << 4 | match_code);
+        }
+
+        /// Read a length continued by bytes of 255, return false past the
+        /// end of the input
+        inline bool read_length(const unsigned char*& in,
+                                const unsigned char* end, std::size_t& length)
+        {
+            unsigned char byte;
+            do
+            {
+                if (in >= end)
+                    return false;
+                byte = *in++;
+                length += byte;
+            } while (byte == 255);
+
+            return true;
+        }
+    } // namespace
+
+    std::size_t lz4_bound(std::size_t size)
+    {
+        return size + size / 255 + 16;
+    }
+
+    void lz4_compress(const char* input, std::size_t size,
+                      std::vector<char>& output)
+    {
+        output.resize(lz4_bound(size));
+        char* out = output.data();
+
+        const char* anchor = input;
+
+        if (size > match_limit)
+        {
+            // Positions are stored relative to the input, unset entries point
+            // to its start which is checked like any other candidate
+            std::array<std::uint32_t, 1 << hash_log> table{};
+
+            const char* end = input + size - match_limit;
+            const char* p = input + 1;
+
+            while (p < end)
+            {
+                auto sequence = read32(p);
+                auto& entry = table[hash(sequence)];
+                const char* candidate = input + entry;
+                entry = p - input;
+
+                if (static_cast<std::size_t>(p - candidate) > max_offset
+                    || candidate == p || read32(candidate) != sequence)
+                {
+                    p++;
+                    continue;
+                }
+
+                // Extend the match, leaving the last literals alone
+                const char* match_end = p + min_match;
+                const char* limit = input + size - last_literals;
+                const char* c = candidate + min_match;
+                while (match_end < limit && *match_end == *c)
+                {
+                    match_end++;
+                    c++;
+                }
+
+                write_sequence(out, anchor, p - anchor, match_end - p,
+                               p - candidate);
+
+                p = anchor = match_end;
+            }
+        }
+
+        write_sequence(out, anchor, input + size - anchor, 0, 0);
+
+        output.resize(out - output.data());
+    }
+
+    bool lz4_decompress(const char* input, std::size_t input_size, char* output,
+                        std::size_t size)
+    {
+        auto in = reinterpret_cast<const unsigned char*>(input);
+        auto in_end = in + input_size;
+
+        char* out = output;
+        char* out_end = output + size;
+
+        while (in < in_end)
+        {
+            unsigned token = *in++;
+
+            std::size_t nb_literals = token >> 4;
+            if (nb_literals == 15 && !read_length(in, in_end, nb_literals))
+                return false;
+
+            if (nb_literals > static_cast<std::size_t>(in_end - in)
+                || nb_literals > static_cast<std::size_t>(out_end - out))
+                return false;
+
+            std::memcpy(out, in, nb_literals);
+            in += nb_literals;
+            out += nb_literals;
+
+            // Last sequence
+            if (in == in_end)
+                break;
+
+            if (in_end - in < 2)
+                return false;
+
+            std::size_t offset = in[0] | in[1] << 8;
+            in += 2;
+
+            std::size_t match_length = token & 15;
+            if (match_length == 15 && !read_length(in, in_end, match_length))
+                return false;
+            match_length += min_match;
+
+            if (!offset || offset > static_cast<std::size_t>(out - output)
+                || match_length > static_cast<std::size_t>(out_end - out))
+                return false;
+
+            // Byte per byte, matches may overlap what they produce
+            const char* match = out - offset;
+            for (std::size_t i = 0; i < match_length; i++)
+                *out++ = match[i];
+        }
+
+        return out == out_end;
+    }
+} // namespace utils
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace utils
+{
+    /// Compression in the LZ4 block format: a greedy single pass over the
+    /// input with a hash table of the last positions of 4-byte sequences,
+    /// fast enough to run on every batch sent
+
+    /// Largest size of the compression of `size` bytes
+    std::size_t lz4_bound(std::size_t size);
+
+    /// Compress `size` bytes into `output`, which is resized to the size of
+    /// the compressed block
+    void lz4_compress(const char* input, std::size_t size,
+                      std::vector<char>& output);
+
+    /// Decompress a block expected to hold `size` bytes, return whether the
+    /// block was valid and had the expected size
+    bool lz4_decompress(const char* input, std::size_t input_size, char* output,
+                        std::size_t size);
+} // namespace utils
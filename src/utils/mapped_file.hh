@@ -0,0 +1,82 @@
+#pragma once
+
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+namespace utils
+{
+    /// Read-only memory mapping of a whole file, pages are loaded from the
+    /// page cache on access
+    class MappedFile
+    {
+    public:
+        MappedFile() = default;
+
+        MappedFile(const std::string& path)
+        {
+            int fd = open(path.c_str(), O_RDONLY);
+            if (fd < 0)
+                return;
+
+            struct stat info;
+            if (!fstat(fd, &info) && info.st_size > 0)
+            {
+                void* data =
+                    mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+                if (data != MAP_FAILED)
+                {
+                    data_ = static_cast<const char*>(data);
+                    size_ = info.st_size;
+                }
+            }
+
+            // The mapping stays valid once the descriptor is closed
+            close(fd);
+        }
+
+        MappedFile(MappedFile&& other)
+            : data_(std::exchange(other.data_, nullptr))
+            , size_(std::exchange(other.size_, 0))
+        {}
+
+        MappedFile& operator=(MappedFile&& other)
+        {
+            std::swap(data_, other.data_);
+            std::swap(size_, other.size_);
+            return *this;
+        }
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        ~MappedFile()
+        {
+            if (data_)
+                munmap(const_cast<char*>(data_), size_);
+        }
+
+        inline operator bool() const
+        {
+            return data_;
+        }
+
+        inline const char* data() const
+        {
+            return data_;
+        }
+
+        inline std::size_t size() const
+        {
+            return size_;
+        }
+
+    private:
+        const char* data_ = nullptr;
+        std::size_t size_ = 0;
+    };
+} // namespace utils
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <algorithm>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "common.hh"
+#include "rpc/rpc.hh"
+
+namespace utils
+{
+    /// Role of each server in a group, as set by the last configuration entry
+    /// of its log. Only voters elect the leader and count toward a majority,
+    /// learners receive the entries until they are promoted, the other
+    /// servers are spares which receive nothing.
+    class Membership
+    {
+    public:
+        enum class Role : char
+        {
+            NONE = '-',
+            LEARNER = 'l',
+            VOTER = 'v',
+        };
+
+        /// Largest number of servers a configuration entry can describe
+        static constexpr int max_servers = sizeof(rpc::command_t) - 1;
+
+        /// Servers are numbered from 1 to `nb_server`, the first `nb_voter`
+        /// ones are voters
+        Membership(int nb_server, int nb_voter)
+            : roles_(nb_server, static_cast<char>(Role::NONE))
+        {
+            std::fill_n(roles_.begin(), nb_voter,
+                        static_cast<char>(Role::VOTER));
+        }
+
+        /// Configuration stored in the command of an entry, one role per
+        /// server, nullopt if it is not one
+        static std::optional<Membership> decode(const rpc::command_t& command)
+        {
+            Membership membership(0, 0);
+            membership.roles_.assign(command.data(), command.size());
+
+            for (auto role : membership.roles_)
+                if (role != static_cast<char>(Role::NONE)
+                    && role != static_cast<char>(Role::LEARNER)
+                    && role != static_cast<char>(Role::VOTER))
+                    return {};
+
+            return membership;
+        }
+
+        inline rpc::command_t encode() const
+        {
+            return rpc::command_t(roles_);
+        }
+
+        inline Role role(rank server) const
+        {
+            return static_cast<Role>(roles_[server - 1]);
+        }
+
+        inline void set(rank server, Role role)
+        {
+            roles_[server - 1] = static_cast<char>(role);
+        }
+
+        inline bool voter(rank server) const
+        {
+            return role(server) == Role::VOTER;
+        }
+
+        /// Voters and learners, the servers entries are sent to
+        inline bool member(rank server) const
+        {
+            return role(server) != Role::NONE;
+        }
+
+        inline int nb_voter() const
+        {
+            return std::count(roles_.begin(), roles_.end(),
+                              static_cast<char>(Role::VOTER));
+        }
+
+        /// Whether `count` voters are a majority of them
+        inline bool majority(int count) const
+        {
+            return count > nb_voter() / 2;
+        }
+
+        /// Whether each server is a voter, indexed by rank
+        inline std::vector<bool> voters() const
+        {
+            std::vector<bool> voters(roles_.size() + 1);
+            for (std::size_t i = 0; i < roles_.size(); i++)
+                voters[i + 1] = roles_[i] == static_cast<char>(Role::VOTER);
+            return voters;
+        }
+
+        /// One character per server, e.g. `vvvl-`
+        inline const std::string& str() const
+        {
+            return roles_;
+        }
+
+    private:
+        std::string roles_;
+    };
+} // namespace utils
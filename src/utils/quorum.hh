@@ -0,0 +1,101 @@
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+namespace utils
+{
+    /// Highest log index replicated on a majority of the voting servers,
+    /// derived from the index each server is known to match
+    class QuorumIndex
+    {
+    public:
+        /// Servers are numbered from 1 to `nb_server`, all of them vote
+        QuorumIndex(int nb_server)
+            : match_(nb_server + 1, -1)
+            , voters_(nb_server + 1, true)
+            , scratch_()
+            , index_(-1)
+        {
+            voters_[0] = false;
+            scratch_.reserve(nb_server);
+        }
+
+        /// Forget every match, e.g. when a new leader is elected
+        inline void reset()
+        {
+            std::fill(match_.begin(), match_.end(), -1);
+            index_ = -1;
+        }
+
+        /// Record that `server` matches the log up to `index`. Acks may come
+        /// late or out of order, a match index never goes back. Return
+        /// whether the quorum index moved forward.
+        inline bool update(int server, int index)
+        {
+            if (index <= match_[server])
+                return false;
+
+            bool below = match_[server] <= index_;
+            match_[server] = index;
+
+            // The quorum index can only move when a voter crosses it
+            if (!voters_[server] || !below || index <= index_)
+                return false;
+
+            auto quorum = compute();
+            if (quorum <= index_)
+                return false;
+
+            index_ = quorum;
+            return true;
+        }
+
+        /// Change which servers vote, indexed by rank. The quorum index is
+        /// computed again, return whether it moved forward.
+        inline bool set_voters(std::vector<bool> voters)
+        {
+            voters_ = std::move(voters);
+
+            auto quorum = compute();
+            std::swap(quorum, index_);
+
+            return index_ > quorum;
+        }
+
+        inline int match(int server) const
+        {
+            return match_[server];
+        }
+
+        inline int index() const
+        {
+            return index_;
+        }
+
+    private:
+        /// Order statistic on a scratch copy, the majority of voters is at
+        /// or above the (n / 2)th greatest match index
+        inline int compute()
+        {
+            scratch_.clear();
+            for (std::size_t i = 1; i < match_.size(); i++)
+                if (voters_[i])
+                    scratch_.push_back(match_[i]);
+
+            if (scratch_.empty())
+                return -1;
+
+            auto quorum = scratch_.begin() + scratch_.size() / 2;
+            std::nth_element(scratch_.begin(), quorum, scratch_.end(),
+                             std::greater<int>());
+            return *quorum;
+        }
+
+        std::vector<int> match_;
+        std::vector<bool> voters_;
+        std::vector<int> scratch_;
+        int index_;
+    };
+} // namespace utils
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cmath>
+
+namespace utils
+{
+    /// Smoothed round trip time estimation of a link, in seconds, computed the
+    /// same way as TCP retransmission timeouts (RFC 6298)
+    class RttEstimator
+    {
+    public:
+        RttEstimator() = default;
+
+        inline void add(double sample)
+        {
+            if (!samples_)
+            {
+                srtt_ = sample;
+                rttvar_ = sample / 2;
+            }
+            else
+            {
+                rttvar_ = 0.75 * rttvar_ + 0.25 * std::abs(srtt_ - sample);
+                srtt_ = 0.875 * srtt_ + 0.125 * sample;
+            }
+
+            samples_++;
+        }
+
+        /// Whether at least one sample was measured
+        inline operator bool() const
+        {
+            return samples_;
+        }
+
+        inline double srtt() const
+        {
+            return srtt_;
+        }
+
+        /// Upper bound of the time to wait for an answer on this link
+        inline double rto() const
+        {
+            return srtt_ + 4 * rttvar_;
+        }
+
+    private:
+        double srtt_ = 0;
+        double rttvar_ = 0;
+        unsigned long samples_ = 0;
+    };
+} // namespace utils
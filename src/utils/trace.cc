@@ -0,0 +1,109 @@
+#include "utils/trace.hh"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <set>
+#include <sstream>
+
+#include "rpc/rpc.hh"
+
+namespace utils
+{
+    namespace
+    {
+        /// Thread id of a lane, exact in a double as long as clients are
+        /// less than 2^13 and lanes less than 2^8
+        std::uint64_t track(rank client, unsigned id, rank lane)
+        {
+            return static_cast<std::uint64_t>(client) << 40
+                | static_cast<std::uint64_t>(id) << 8
+                | static_cast<std::uint8_t>(lane);
+        }
+    } // namespace
+
+    Tracer::Tracer(rank rank, unsigned sampling, std::string name,
+                   std::size_t capacity)
+        : rank_(rank)
+        , sampling_(sampling)
+        , name_(std::move(name))
+        , events_()
+        , capacity_(capacity)
+        , next_(0)
+    {
+        if (sampling_)
+            events_.reserve(capacity_);
+    }
+
+    bool Tracer::enabled() const
+    {
+        return sampling_;
+    }
+
+    bool Tracer::sampled(rank client, unsigned id) const
+    {
+        // Clients start their ids from 0, mixing in the client spreads the
+        // sampled requests over time. Entries of the servers are not
+        // requests.
+        return sampling_ && !rpc::internal_entry(client)
+            && (id + client) % sampling_ == 0;
+    }
+
+    void Tracer::span(const char* name, rank client, unsigned id, double begin,
+                      double end, rank lane)
+    {
+        Event event{name, client, id, begin, end, lane};
+
+        if (events_.size() < capacity_)
+            events_.push_back(event);
+        else
+            events_[next_] = event;
+
+        next_ = (next_ + 1) % capacity_;
+    }
+
+    double Tracer::origin() const
+    {
+        double origin = std::numeric_limits<double>::max();
+        for (const auto& event : events_)
+            origin = std::min(origin, event.begin);
+        return origin;
+    }
+
+    std::string Tracer::to_json(double origin) const
+    {
+        std::ostringstream json;
+        json.setf(std::ios::fixed);
+        json.precision(3);
+
+        json << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << rank_
+             << ",\"args\":{\"name\":\"" << name_ << "\"}}";
+
+        std::set<std::uint64_t> named;
+
+        for (const auto& event : events_)
+        {
+            auto tid = track(event.client, event.id, event.lane);
+
+            if (named.insert(tid).second)
+            {
+                json << ",{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":"
+                     << rank_ << ",\"tid\":" << tid
+                     << ",\"args\":{\"name\":\"client " << event.client
+                     << " request " << event.id;
+                if (event.lane)
+                    json << " to server " << event.lane;
+                json << "\"}}";
+            }
+
+            json << ",{\"name\":\"" << event.name
+                 << "\",\"ph\":\"X\",\"pid\":" << rank_ << ",\"tid\":" << tid
+                 << ",\"ts\":" << (event.begin - origin) * 1e6
+                 << ",\"dur\":" << (event.end - event.begin) * 1e6
+                 << ",\"args\":{\"client\":" << event.client
+                 << ",\"id\":" << event.id << "}}";
+        }
+
+        return json.str();
+    }
+} // namespace utils
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "common.hh"
+
+namespace utils
+{
+    /// Spans of the lifecycle of sampled client requests, kept in a ring
+    /// buffer and exported as Chrome trace events. Requests are sampled on
+    /// their client and id, so that every process traces the same ones. Each
+    /// request has its own tracks in every process, lane 0 for its lifecycle
+    /// and one lane per server it is sent to, so that concurrent requests do
+    /// not overlap.
+    class Tracer
+    {
+    public:
+        /// Trace one request in `sampling`, none if 0. `name` names the
+        /// process in the trace.
+        Tracer(rank rank, unsigned sampling, std::string name,
+               std::size_t capacity = 1 << 16);
+
+        bool enabled() const;
+        bool sampled(rank client, unsigned id) const;
+
+        /// Record `name` from `begin` to `end`, in seconds, on the lane
+        /// `lane` of the request
+        void span(const char* name, rank client, unsigned id, double begin,
+                  double end, rank lane = 0);
+
+        /// Earliest recorded time, a huge value if nothing was recorded
+        double origin() const;
+
+        /// Events as comma separated JSON objects, times in microseconds from
+        /// `origin`
+        std::string to_json(double origin) const;
+
+    private:
+        struct Event
+        {
+            const char* name;
+            rank client;
+            unsigned id;
+            double begin;
+            double end;
+            rank lane;
+        };
+
+        rank rank_;
+        unsigned sampling_;
+        std::string name_;
+
+        /// Ring buffer, the oldest events are overwritten once full
+        std::vector<Event> events_;
+        std::size_t capacity_;
+        std::size_t next_;
+    };
+} // namespace utils
@@ -13,14 +13,31 @@ check_diff()
     return 0
 }
 
+# Exports of the scenarios run with export_log=1 must agree on every
+# commited entry
+check_exports()
+{
+    set -- committed_server*.bin
+    if [ ! -f "$1" ] ; then
+        return 0
+    fi
+
+    tools/check_logs --verify "$@" > /dev/null
+}
+
 run_test()
 {
     echo "testing $1"
 
+    # Make variables of the scenario, e.g. NCMD or OPTIONS
+    vars="${1%.txt}.vars"
+
+    rm -f committed_server*.bin
+
     # Sorry
-    cat "$1" | make run > /dev/null
+    cat "$1" | make run $([ -f "$vars" ] && cat "$vars") > /dev/null
 
-    check_diff 5
+    check_diff "${NSERVER:-5}" && check_exports
 
     if [ $? -ne 0 ] ; then
         echo "FAILED"
@@ -29,6 +46,8 @@ run_test()
     fi
 }
 
+make tools > /dev/null
+
 for f in $(echo tests/*.txt); do
     run_test "$f"
 done
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <iostream>
+
+// Helpers shared by the unit tests, each of which is a program printing the
+// checks which failed and exiting with a non-zero status if any did.
+
+namespace check
+{
+    inline int failures = 0;
+
+    inline void expect(bool condition, const char* expression,
+                       const char* file, int line)
+    {
+        if (condition)
+            return;
+
+        std::cerr << file << ":" << line << ": check failed: " << expression
+                  << "\n";
+        failures++;
+    }
+
+    /// Exit status of the test program named `name`
+    inline int report(const char* name)
+    {
+        std::cout << name << ": " << (failures ? "FAILED" : "SUCCESS") << "\n";
+        return failures != 0;
+    }
+} // namespace check
+
+#define CHECK(condition)                                                       \
+    check::expect((condition), #condition, __FILE__, __LINE__)
@@ -0,0 +1,42 @@
+#include "utils/crc32c.hh"
+
+#include <vector>
+
+#include "check.hh"
+
+namespace
+{
+    void check_value()
+    {
+        const char* data = "123456789";
+
+        CHECK(utils::crc32c(data, 9) == 0xE3069283);
+        CHECK(utils::crc32c_portable(data, 9) == 0xE3069283);
+
+        // Checksum of data spread over several buffers
+        CHECK(utils::crc32c(data + 4, 5, utils::crc32c(data, 4))
+              == 0xE3069283);
+    }
+
+    void unaligned()
+    {
+        std::vector<unsigned char> bytes(64 + 8);
+        for (std::size_t i = 0; i < bytes.size(); i++)
+            bytes[i] = i * 37 + 11;
+
+        // Every start not aligned on 8 bytes and every length, to go through
+        // the head, body and tail of the accelerated implementation
+        for (std::size_t start = 0; start < 8; start++)
+            for (std::size_t size = 0; size <= 64; size++)
+                CHECK(utils::crc32c(bytes.data() + start, size)
+                      == utils::crc32c_portable(bytes.data() + start, size));
+    }
+} // namespace
+
+int main()
+{
+    check_value();
+    unaligned();
+
+    return check::report("crc32c");
+}
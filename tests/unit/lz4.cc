@@ -0,0 +1,124 @@
+#include "utils/lz4.hh"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "check.hh"
+
+namespace
+{
+    /// Compress then decompress `input`, return whether it was restored
+    bool round_trip(const std::string& input)
+    {
+        std::vector<char> block;
+        utils::lz4_compress(input.data(), input.size(), block);
+
+        if (block.size() > utils::lz4_bound(input.size()))
+            return false;
+
+        std::string output(input.size(), '\0');
+        return utils::lz4_decompress(block.data(), block.size(),
+                                     output.data(), output.size())
+            && output == input;
+    }
+
+    void small_inputs()
+    {
+        // Around match_limit, below which everything is a literal
+        for (std::size_t size = 0; size <= 13; size++)
+        {
+            CHECK(round_trip(std::string(size, 'a')));
+
+            std::string input;
+            for (std::size_t i = 0; i < size; i++)
+                input += static_cast<char>('a' + i % 3);
+            CHECK(round_trip(input));
+        }
+    }
+
+    void long_runs()
+    {
+        // Matches at offset 1 or 2 overlap the bytes they produce
+        std::string run(100000, 'x');
+        CHECK(round_trip(run));
+
+        std::string pattern;
+        for (int i = 0; i < 50000; i++)
+            pattern += "ab";
+        CHECK(round_trip(pattern));
+
+        std::vector<char> block;
+        utils::lz4_compress(run.data(), run.size(), block);
+        CHECK(block.size() < run.size() / 100);
+    }
+
+    void incompressible()
+    {
+        std::string input(65536, '\0');
+        std::uint32_t state = 2463534242u;
+        for (auto& c : input)
+        {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            c = static_cast<char>(state);
+        }
+
+        CHECK(round_trip(input));
+    }
+
+    void truncated()
+    {
+        std::string input;
+        for (int i = 0; i < 1000; i++)
+            input += "entry " + std::to_string(i % 10) + ";";
+
+        std::vector<char> block;
+        utils::lz4_compress(input.data(), input.size(), block);
+
+        std::string output(input.size(), '\0');
+        for (std::size_t size = 0; size < block.size(); size++)
+            CHECK(!utils::lz4_decompress(block.data(), size, output.data(),
+                                         output.size()));
+
+        // A valid block with a size other than the expected one
+        CHECK(!utils::lz4_decompress(block.data(), block.size(),
+                                     output.data(), output.size() - 1));
+    }
+
+    void corrupted()
+    {
+        char output[64];
+
+        auto decompress = [&](const std::vector<unsigned char>& block) {
+            return utils::lz4_decompress(
+                reinterpret_cast<const char*>(block.data()), block.size(),
+                output, sizeof(output));
+        };
+
+        // Offset of 0
+        CHECK(!decompress({0x10, 'a', 0x00, 0x00, 0x10, 'a'}));
+        // Offset before the start of the output
+        CHECK(!decompress({0x10, 'a', 0x05, 0x00, 0x10, 'a'}));
+        // Offset cut short
+        CHECK(!decompress({0x10, 'a', 0x01}));
+        // Literals past the end of the block
+        CHECK(!decompress({0x50, 'a', 'b'}));
+        // Length continued past the end of the block
+        CHECK(!decompress({0xf0, 0xff}));
+        // Match past the end of the output
+        CHECK(!decompress({0x1f, 'a', 0x01, 0x00, 0xff, 0x00, 0x10, 'a'}));
+    }
+} // namespace
+
+int main()
+{
+    small_inputs();
+    long_runs();
+    incompressible();
+    truncated();
+    corrupted();
+
+    return check::report("lz4");
+}
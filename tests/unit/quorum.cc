@@ -0,0 +1,101 @@
+#include "utils/quorum.hh"
+
+#include "check.hh"
+
+using utils::QuorumIndex;
+
+namespace
+{
+    void out_of_order_acks()
+    {
+        QuorumIndex quorum(5);
+
+        CHECK(!quorum.update(1, 10));
+        CHECK(!quorum.update(3, 5));
+        CHECK(quorum.index() == -1);
+
+        // Three of five servers match 5
+        CHECK(quorum.update(2, 7));
+        CHECK(quorum.index() == 5);
+
+        // Below the quorum index, nothing moves
+        CHECK(!quorum.update(4, 3));
+        CHECK(quorum.index() == 5);
+
+        CHECK(quorum.update(4, 8));
+        CHECK(quorum.index() == 7);
+    }
+
+    void whole_batch()
+    {
+        QuorumIndex quorum(3);
+
+        CHECK(!quorum.update(1, 255));
+        CHECK(quorum.update(2, 255));
+        CHECK(quorum.index() == 255);
+
+        CHECK(!quorum.update(1, 511));
+        CHECK(quorum.update(3, 511));
+        CHECK(quorum.index() == 511);
+    }
+
+    void stale_ack()
+    {
+        QuorumIndex quorum(3);
+
+        quorum.update(1, 9);
+        CHECK(quorum.update(2, 7));
+
+        // A late ack of an earlier AppendEntries
+        CHECK(!quorum.update(2, 4));
+        CHECK(quorum.match(2) == 7);
+        CHECK(quorum.index() == 7);
+
+        quorum.reset();
+        CHECK(quorum.index() == -1);
+        CHECK(quorum.match(2) == -1);
+    }
+
+    void voters_change()
+    {
+        QuorumIndex quorum(5);
+
+        // Servers 4 and 5 lag behind with entries in flight
+        quorum.update(1, 10);
+        quorum.update(2, 10);
+        quorum.update(3, 2);
+        quorum.update(4, 2);
+        quorum.update(5, 2);
+        CHECK(quorum.index() == 2);
+
+        // Removing them leaves a majority at 10
+        CHECK(quorum.set_voters({false, true, true, true, false, false}));
+        CHECK(quorum.index() == 10);
+
+        // Learners do not count, however far they are
+        CHECK(!quorum.update(5, 20));
+        CHECK(!quorum.update(4, 20));
+        CHECK(quorum.index() == 10);
+
+        // Promoting them counts their match again
+        CHECK(!quorum.set_voters({false, true, true, true, true, true}));
+        CHECK(quorum.index() == 10);
+        CHECK(quorum.update(3, 20));
+        CHECK(quorum.index() == 20);
+
+        // Removing voters ahead of the others moves the quorum index back,
+        // the commit index of the group never does
+        CHECK(!quorum.set_voters({false, true, true, true, false, false}));
+        CHECK(quorum.index() == 10);
+    }
+} // namespace
+
+int main()
+{
+    out_of_order_acks();
+    whole_batch();
+    stale_ack();
+    voters_change();
+
+    return check::report("quorum");
+}
@@ -0,0 +1,187 @@
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "utils/committed_log.hh"
+#include "utils/mapped_file.hh"
+
+// Check that replicas agree on their commited entries, from the binary
+// exports written with export_log=1. Records chain the hash of every entry
+// before them, so the agreement of two replicas on their common prefix is
+// settled by the hashes at its last index, and their first divergence is
+// found by a binary search. With --verify, every chain is also recomputed
+// in a single pass, which catches an export damaged on disk.
+
+namespace
+{
+    using utils::committed_log::Record;
+
+    struct Replica
+    {
+        std::string path;
+        utils::MappedFile file;
+        const Record* records;
+        std::size_t size;
+    };
+
+    bool open(Replica& replica)
+    {
+        auto& magic = utils::committed_log::magic;
+
+        replica.file = utils::MappedFile(replica.path);
+        auto size = replica.file.size();
+
+        if (size < magic.size()
+            || std::memcmp(replica.file.data(), magic.data(), magic.size()))
+        {
+            std::cerr << replica.path << ": not a commited log export\n";
+            return false;
+        }
+
+        // MappedFile is page aligned, records are right after the magic
+        replica.records =
+            reinterpret_cast<const Record*>(replica.file.data() + magic.size());
+        replica.size = (size - magic.size()) / sizeof(Record);
+
+        madvise(const_cast<char*>(replica.file.data()), size, MADV_RANDOM);
+
+        return true;
+    }
+
+    /// Index of the first record of `replica` whose hash does not follow
+    /// from the previous ones, its size if none
+    std::size_t verify(const Replica& replica)
+    {
+        madvise(const_cast<char*>(replica.file.data()), replica.file.size(),
+                MADV_SEQUENTIAL);
+
+        std::uint64_t hash = 0;
+        for (std::size_t i = 0; i < replica.size; i++)
+        {
+            const auto& record = replica.records[i];
+            hash = utils::committed_log::chain(hash, record.term, record.crc);
+
+            if (hash != record.hash)
+                return i;
+        }
+
+        return replica.size;
+    }
+
+    /// Length of the prefix shared by `a` and `b`
+    std::size_t common_prefix(const Replica& a, const Replica& b)
+    {
+        auto size = std::min(a.size, b.size);
+
+        if (!size || a.records[size - 1].hash == b.records[size - 1].hash)
+            return size;
+
+        // Hashes differ from the first divergence on
+        std::size_t low = 0;
+        std::size_t high = size - 1;
+        while (low < high)
+        {
+            auto middle = low + (high - low) / 2;
+            if (a.records[middle].hash == b.records[middle].hash)
+                low = middle + 1;
+            else
+                high = middle;
+        }
+
+        return low;
+    }
+
+    void print_record(const Replica& replica, std::size_t index)
+    {
+        std::cout << "  " << replica.path << ": ";
+
+        if (index < replica.size)
+            std::cout << "term " << replica.records[index].term << ", crc "
+                      << std::hex << replica.records[index].crc << std::dec
+                      << "\n";
+        else
+            std::cout << "no entry\n";
+    }
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    std::vector<Replica> replicas;
+    bool full = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!std::strcmp(argv[i], "--verify"))
+            full = true;
+        else
+            replicas.push_back(Replica{argv[i], {}, nullptr, 0});
+    }
+
+    if (replicas.size() < 2)
+    {
+        std::cerr << "usage: " << argv[0]
+                  << " [--verify] committed_server<rank>.bin...\n";
+        return 2;
+    }
+
+    for (auto& replica : replicas)
+        if (!open(replica))
+            return 2;
+
+    bool valid = true;
+
+    if (full)
+    {
+        for (const auto& replica : replicas)
+        {
+            auto index = verify(replica);
+            if (index < replica.size)
+            {
+                std::cout << replica.path << ": broken hash chain at index "
+                          << index << "\n";
+                valid = false;
+            }
+        }
+    }
+
+    // Every replica is compared with the longest one, all the others are
+    // prefixes of it when they agree
+    std::size_t longest = 0;
+    for (std::size_t i = 1; i < replicas.size(); i++)
+        if (replicas[i].size > replicas[longest].size)
+            longest = i;
+
+    // Shorter replicas which agree are still catching up, the others diverge
+    std::size_t agreed = replicas[longest].size;
+    std::size_t divergence = replicas[longest].size;
+    std::size_t divergent = replicas.size();
+
+    for (std::size_t i = 0; i < replicas.size(); i++)
+    {
+        auto prefix = common_prefix(replicas[longest], replicas[i]);
+        agreed = std::min(agreed, prefix);
+
+        if (prefix < replicas[i].size && prefix < divergence)
+        {
+            divergence = prefix;
+            divergent = i;
+        }
+    }
+
+    for (const auto& replica : replicas)
+        std::cout << replica.path << ": " << replica.size << " entries\n";
+
+    if (divergent == replicas.size())
+    {
+        std::cout << "replicas agree, " << agreed
+                  << " entries are on every replica\n";
+        return valid ? 0 : 1;
+    }
+
+    std::cout << "replicas diverge at index " << divergence << "\n";
+    print_record(replicas[longest], divergence);
+    print_record(replicas[divergent], divergence);
+
+    return 1;
+}